@@ -3,32 +3,37 @@
 #include "config.h"
 
 #include "lib/frame-collection.hpp"
+#include "lib/frame-prefetcher.hpp"
 #include "lib/mat-to-texture.hpp"
 #include "lib/window.hpp"
 
 int main(int argc, const char *argv[]) {
-  std::cout << "Preloading frames…\n";
-
   auto lastFrame = std::chrono::high_resolution_clock::now();
 
   std::string name(argv[1]);
-  FrameCollection frames(name);
-  frames.preloadAll();
+  bool write = argv[2] && strcmp(argv[2], "--write") == 0;
+  bool video = write && argc > 3 && strcmp(argv[3], "--video") == 0;
 
-  auto loadFinish = std::chrono::high_resolution_clock::now();
-  std::chrono::duration<float> loadDuration = loadFinish - lastFrame;
+  // Originals are only needed for the frames written to disk
+  FrameCollection frames(name);
+  frames.usePreviews(PREVIEWS_ENABLED && !write);
 
-  std::cout << "Preloaded frames in " << loadDuration.count() << "s\n";
+  std::cout << "Assigned images: " << frames.assignment() << '\n';
+  std::cout << "Greedy would be: " << frames.greedyAssignment() << '\n';
 
-  if (argv[2] && strcmp(argv[2], "--write") == 0) {
-    auto writeBegin = std::chrono::high_resolution_clock::now();
+  if (write) {
+    std::cout << "Writing frames…\n";
 
-    frames.writeImages(name);
+    auto writeStart = std::chrono::high_resolution_clock::now();
+    frames.writeImages(name, video);
 
     auto writeFinish = std::chrono::high_resolution_clock::now();
-    std::chrono::duration<float> writeDuration = writeFinish - writeBegin;
+    std::chrono::duration<float> writeDuration = writeFinish - writeStart;
     std::cout << "Written " << frames.size() << " frames to disk in "
-      << writeDuration.count() << "s\n";
+      << writeDuration.count() << "s ("
+      << frames.size() / writeDuration.count() << " frames/s)\n";
+    std::cout << "Image cache: " << ImageCache::shared().stats() << '\n';
+    std::cout << "Frame cache: " << FrameCache::shared().stats() << '\n';
 
     return 0;
   }
@@ -38,6 +43,11 @@ int main(int argc, const char *argv[]) {
   int frameId = 0;
   bool playing = false;
   int fps = 5;
+  int direction = 1;
+
+  // Frames are rendered in the background, starting with the first one
+  FramePrefetcher prefetcher(frames);
+  prefetcher.seek(frameId);
 
   initWindow(OUTPUT_WIDTH, OUTPUT_HEIGHT, "Build preview");
   GLuint image_tex;
@@ -47,7 +57,13 @@ int main(int argc, const char *argv[]) {
   std::vector<MatchData>::iterator previewMatch;
 
   auto generateTexture = [&]() {
-    cv::Mat image = doPreview ? frames.imageFor(previewMatch) : frames.imageAt(frameId);
+    cv::Mat image;
+    if (doPreview) {
+      image = frames.imageFor(previewMatch);
+    } else {
+      prefetcher.seek(frameId, direction);
+      image = prefetcher.get(frameId);
+    }
     doPreview = false;
     matToTexture(image, &image_tex);
     matchForFrame = frames.matchAt(frameId);
@@ -58,12 +74,17 @@ int main(int argc, const char *argv[]) {
 
   openWindow([&](GLFWwindow *window, ImGuiIO &io) {
     bool changed = false;
+    // Frames whose match has been edited
+    std::vector<int> changedFrames;
 
     if (playing) {
       auto current = std::chrono::high_resolution_clock::now();
       std::chrono::duration<float> delta = current - lastFrame;
-      if (delta.count() > 1.f / fps) {
-        frameId = frameId == frames.size() - 1 ? 0 : frameId + 1;
+      int nextFrameId = frameId == frames.size() - 1 ? 0 : frameId + 1;
+      // Hold the current frame rather than stall if the next isn't ready
+      if (delta.count() > 1.f / fps && prefetcher.ready(nextFrameId)) {
+        frameId = nextFrameId;
+        direction = 1;
         lastFrame = current;
 
         changed = true;
@@ -78,12 +99,14 @@ int main(int argc, const char *argv[]) {
     if ((ImGui::SmallButton("-") || ImGui::IsKeyPressed(GLFW_KEY_LEFT, false))
         && frameId > 0) {
       --frameId;
+      direction = -1;
       changed = true;
     }
     ImGui::SameLine();
     if ((ImGui::SmallButton("+") || ImGui::IsKeyPressed(GLFW_KEY_RIGHT, false))
         && frameId < frames.size() - 1) {
       ++frameId;
+      direction = 1;
       changed = true;
     }
 
@@ -97,6 +120,7 @@ int main(int argc, const char *argv[]) {
       ImGui::SetNextItemWidth(100);
       ImGui::SliderInt("FPS", &fps, 1, 30);
     }
+    ImGui::Text("Buffered frames: %i", prefetcher.readyCount());
 
     ImGui::NewLine();
 
@@ -119,12 +143,14 @@ int main(int argc, const char *argv[]) {
         frames.editMatchScale(frameId, matchForFrame->scale + 0.01);
         changed = true;
         edited = true;
+        changedFrames.push_back(frameId);
       }
       ImGui::SameLine();
       if (ImGui::SmallButton("+##scale-plus")) {
         frames.editMatchScale(frameId, matchForFrame->scale - 0.01);
         changed = true;
         edited = true;
+        changedFrames.push_back(frameId);
       }
 
       ImGui::Text("x: %i", matchForFrame->originX);
@@ -133,12 +159,14 @@ int main(int argc, const char *argv[]) {
         frames.editMatchOriginX(frameId, matchForFrame->originX - 1);
         changed = true;
         edited = true;
+        changedFrames.push_back(frameId);
       }
       ImGui::SameLine();
       if (ImGui::SmallButton("+##x-plus")) {
         frames.editMatchOriginX(frameId, matchForFrame->originX + 1);
         changed = true;
         edited = true;
+        changedFrames.push_back(frameId);
       }
 
       ImGui::Text("y: %i", matchForFrame->originY);
@@ -147,12 +175,14 @@ int main(int argc, const char *argv[]) {
         frames.editMatchOriginY(frameId, matchForFrame->originY - 1);
         changed = true;
         edited = true;
+        changedFrames.push_back(frameId);
       }
       ImGui::SameLine();
       if (ImGui::SmallButton("+##y-plus")) {
         frames.editMatchOriginY(frameId, matchForFrame->originY + 1);
         changed = true;
         edited = true;
+        changedFrames.push_back(frameId);
       }
 
       ImGui::NewLine();
@@ -163,7 +193,7 @@ int main(int argc, const char *argv[]) {
       if (ImGui::BeginChild("matches")) {
         for (std::vector<MatchData>::iterator match = matchesForFrame->begin();
             match != matchesForFrame->end(); ++match) {
-          ImGui::PushID(match->path.c_str());
+          ImGui::PushID(match->path().c_str());
           if (ImGui::SmallButton("Preview")) {
             previewMatch = match;
             doPreview = true;
@@ -171,7 +201,8 @@ int main(int argc, const char *argv[]) {
           }
           ImGui::SameLine();
           if (ImGui::SmallButton("y")) {
-            frames.forceMatch(frameId, match);
+            std::vector<int> moved = frames.forceMatch(frameId, match);
+            changedFrames.insert(changedFrames.end(), moved.begin(), moved.end());
             changed = true;
             // Stop usages of match below segfaulting
             match = matchesForFrame->begin();
@@ -179,14 +210,16 @@ int main(int argc, const char *argv[]) {
           }
           ImGui::SameLine();
           if (ImGui::SmallButton("n")) {
-            frames.removeMatch(frameId, match);
+            std::vector<int> moved = frames.removeMatch(frameId, match);
+            changedFrames.insert(changedFrames.end(), moved.begin(), moved.end());
+            changed = true;
             edited = true;
           }
           ImGui::SameLine();
-          ImGui::Text("%.1f%%: %s", match->percentage * 100, match->path.c_str());
+          ImGui::Text("%.1f%%: %s", match->percentage * 100, match->path().c_str());
           ImGui::SameLine();
           if (ImGui::SmallButton("copy")) {
-            ImGui::SetClipboardText(match->path.c_str());
+            ImGui::SetClipboardText(match->path().c_str());
           }
           ImGui::PopID();
         }
@@ -199,6 +232,7 @@ int main(int argc, const char *argv[]) {
 
     if (changed) {
       saved = false;
+      prefetcher.invalidate(changedFrames);
       generateTexture();
     }
 
@@ -19,12 +19,99 @@
 #define MATCH_MAX_OFFSET 9
 #define MATCH_WHITE_BIAS 0.75
 
+// Warm starts search this many steps either side of an image's last match,
+// and keep what they find if it's no more than this much worse
+#define MATCH_WARM_START_RADIUS 2
+#define MATCH_WARM_START_TOLERANCE 0.02
+
+// Golden section steps when refining scale past the grid
+#define MATCH_REFINE_SCALE_ITERATIONS 8
+
+// Sequential screening checks whether a placement can still win after this
+// many samples and every doubling after, and is wrong this often at most
+#define MATCH_SEQUENTIAL_FIRST_CHECK 256
+#define MATCH_SEQUENTIAL_ERROR_RATE 0.01f
+
+// Angles searched either side of each orientation are this far apart. Every
+// this many of them are searched first, then the gaps around the best are
+// halved until they're this far apart again
+#define MATCH_ANGLE_STEP 2.5f
+#define MATCH_ANGLE_COARSE_STEPS 4
+
+// Template pixels outside the canvas once it's rotated, which aren't scored
+#define MATCH_TEMPLATE_OUTSIDE 1
+
+// Points along a vector template's outline are this far apart on the canvas.
+// Neighbours landing on the same pixel of the edges are only tested once
+#define MATCH_OUTLINE_SPACING 0.25f
+
+// Unpacked edges kept between queries. Edges mapped from `.edges` files are
+// never kept, so that matching them stays within MATCH_RESIDENT_BUDGET_MB
+#define MATCH_PLANE_CACHE_MB 512
+
+// Decoded originals, shared by previews and frame rendering
+#define IMAGE_CACHE_MB 2048
+
+// Keep the edges of every image in one contiguous, cache line aligned block
+#define EDGE_ARENA_ENABLED 1
+#define EDGE_ARENA_HUGE_PAGES 0
+
+// Run length encode edges in stores, and keep them that way in memory
+#define EDGE_RUNS_ON_DISK 1
+#define EDGE_RUNS_IN_MEMORY 0
+
+// An image's ID is the index of the directory it's in, times this, plus its
+// serial number in that directory's store
+#define IMAGE_ID_MOUNT_STRIDE 1000000
+
+// Write each store's edges to a `.edges` file when saving, and map them from
+// it instead of loading them, only keeping this much of them in memory at
+// once while matching
+#define MATCH_OUT_OF_CORE 0
+#define MATCH_RESIDENT_BUDGET_MB 1024
+
+// Candidates kept for each frame. Assignments are the same as keeping them all
+// as long as this is at least the number of frames
+#define FRAME_CANDIDATES 500
+// Save frame data in the binary `.frames` format rather than as text
+#define FRAME_DATA_BINARY 1
+
 #define CANVAS_WIDTH 300
 #define CANVAS_HEIGHT 200
 
 #define OUTPUT_WIDTH 1500
 #define OUTPUT_HEIGHT 1000
 
+// Frames `build` renders ahead of (and keeps behind) the current one
+#define BUILD_PREFETCH_AHEAD 60
+#define BUILD_PREFETCH_BEHIND 10
+
+// Rendered frames are kept JPEG encoded, up to this much of them. Set a spill
+// directory to also keep them on disk, between runs too
+#define FRAME_CACHE_MB 1024
+#define FRAME_CACHE_JPEG_QUALITY 95
+#define FRAME_CACHE_SPILL_DIR ""
+
+// `build --write` keeps no more than this many frames waiting to be added to
+// the video, which plays at this rate
+#define EXPORT_QUEUE_DEPTH 16
+#define EXPORT_VIDEO_FPS 5
+
+// Previews are rendered from copies this wide, made when images are processed.
+// Edges are still detected from a decode at EDGE_DETECTION_WIDTH, and the
+// preview gets a second decode at PREVIEW_WIDTH. Sharing one decode at
+// PREVIEW_WIDTH for both saves that small decode, but makes edge detection
+// work on up to 16 times the pixels
+#define PREVIEWS_ENABLED 1
+#define PREVIEWS_SHARED_DECODE 0
+#define PREVIEW_WIDTH (OUTPUT_WIDTH * 5 / 2)
+#define PREVIEW_JPEG_QUALITY 90
+
+#define BULK_READER_QUEUE_DEPTH 32
+
+#define WATCH_DEBOUNCE_MS 2000
+#define WATCH_NICENESS 10
+
 enum ImageEdgeModes {
   ImageEdgeMode_Canny,
   ImageEdgeMode_Threshold,
@@ -0,0 +1,241 @@
+#include "bulk-reader.hpp"
+
+#ifdef HAVE_LIBURING
+#include <fcntl.h>
+#include <liburing.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+BulkReader::BulkReader(int queueDepth) : queueDepth(queueDepth) {}
+
+void BulkReader::read(const std::vector<std::string> &paths,
+                      const on_read_fn &onRead) {
+  if (paths.empty()) {
+    return;
+  }
+
+#ifdef HAVE_LIBURING
+  if (readWithUring(paths, onRead)) {
+    return;
+  }
+#endif
+
+  readWithThreads(paths, onRead);
+}
+
+#ifdef HAVE_LIBURING
+// Returns false without reading anything if io_uring isn't usable, e.g. if
+// it's been disabled in the kernel
+bool BulkReader::readWithUring(const std::vector<std::string> &paths,
+                               const on_read_fn &onRead) {
+  struct io_uring ring;
+  if (io_uring_queue_init(queueDepth, &ring, 0) < 0) {
+    return false;
+  }
+
+  struct PendingRead {
+    size_t index;
+    int fd;
+    std::vector<uchar> buffer;
+    size_t done;
+  };
+
+  std::vector<PendingRead> slots(queueDepth);
+  std::vector<int> freeSlots;
+  for (int i = queueDepth - 1; i >= 0; --i) {
+    freeSlots.push_back(i);
+  }
+
+  // Large files might come back in more than one piece, in which case the
+  // rest gets requested again from the same slot
+  auto queueRead = [&](int slot) {
+    PendingRead &pending = slots[slot];
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+    io_uring_prep_read(sqe, pending.fd, pending.buffer.data() + pending.done,
+                       pending.buffer.size() - pending.done, pending.done);
+    io_uring_sqe_set_data(sqe, (void *)(intptr_t)slot);
+  };
+
+  // The slot is freed before onRead is called in case it throws
+  auto finish = [&](int slot, bool success) {
+    PendingRead &pending = slots[slot];
+    close(pending.fd);
+    size_t index = pending.index;
+    std::vector<uchar> buffer = std::move(pending.buffer);
+    pending.buffer = std::vector<uchar>();
+    freeSlots.push_back(slot);
+
+    if (!success) {
+      buffer.clear();
+    }
+    onRead(index, buffer);
+  };
+
+  size_t next = 0;
+  try {
+    while (next < paths.size() || freeSlots.size() < queueDepth) {
+      while (!freeSlots.empty() && next < paths.size()) {
+        size_t index = next++;
+        std::vector<uchar> empty;
+
+        int fd = open(paths[index].c_str(), O_RDONLY);
+        if (fd < 0) {
+          onRead(index, empty);
+          continue;
+        }
+
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) < 0 || fileStat.st_size == 0) {
+          close(fd);
+          onRead(index, empty);
+          continue;
+        }
+
+        int slot = freeSlots.back();
+        freeSlots.pop_back();
+        slots[slot].index = index;
+        slots[slot].fd = fd;
+        slots[slot].buffer.resize(fileStat.st_size);
+        slots[slot].done = 0;
+        queueRead(slot);
+      }
+
+      if (freeSlots.size() == queueDepth) {
+        continue;
+      }
+
+      io_uring_submit(&ring);
+
+      struct io_uring_cqe *cqe;
+      if (io_uring_wait_cqe(&ring, &cqe) < 0) {
+        throw std::runtime_error("Failed to wait for io_uring completion");
+      }
+
+      int slot = (intptr_t)io_uring_cqe_get_data(cqe);
+      int result = cqe->res;
+      io_uring_cqe_seen(&ring, cqe);
+
+      PendingRead &pending = slots[slot];
+      if (result <= 0) {
+        finish(slot, false);
+      } else {
+        pending.done += result;
+        if (pending.done < pending.buffer.size()) {
+          queueRead(slot);
+        } else {
+          finish(slot, true);
+        }
+      }
+    }
+  } catch (...) {
+    // Reads still in flight are writing into our buffers, so they have to
+    // finish before anything is freed
+    io_uring_submit(&ring);
+    for (size_t i = freeSlots.size(); i < queueDepth; ++i) {
+      struct io_uring_cqe *cqe;
+      if (io_uring_wait_cqe(&ring, &cqe) == 0) {
+        close(slots[(intptr_t)io_uring_cqe_get_data(cqe)].fd);
+        io_uring_cqe_seen(&ring, cqe);
+      }
+    }
+    io_uring_queue_exit(&ring);
+    throw;
+  }
+
+  io_uring_queue_exit(&ring);
+  return true;
+}
+#endif
+
+void BulkReader::readWithThreads(const std::vector<std::string> &paths,
+                                 const on_read_fn &onRead) {
+  std::atomic_size_t nextIndex(0);
+  std::mutex readMutex;
+  std::condition_variable readCondition;
+  std::queue<std::pair<size_t, std::vector<uchar>>> completed;
+  bool stopping = false;
+
+  auto threadFn = [&]() {
+    while (true) {
+      size_t index = nextIndex++;
+      if (index >= paths.size()) {
+        break;
+      }
+
+      std::vector<uchar> buffer = readFile(paths[index]);
+
+      std::unique_lock<std::mutex> lock(readMutex);
+      // Don't get too far ahead of whoever is decoding the buffers
+      readCondition.wait(lock, [&]() {
+        return stopping || completed.size() < queueDepth;
+      });
+      if (stopping) {
+        break;
+      }
+      completed.emplace(index, std::move(buffer));
+      readCondition.notify_all();
+    }
+  };
+
+  int threads = std::min((size_t)queueDepth, paths.size());
+  std::vector<std::thread> threadVector;
+  threadVector.reserve(threads);
+  for (int i = 0; i < threads; ++i) {
+    threadVector.emplace_back(threadFn);
+  }
+
+  auto stop = [&]() {
+    {
+      std::lock_guard<std::mutex> lock(readMutex);
+      stopping = true;
+      nextIndex = paths.size();
+    }
+    readCondition.notify_all();
+
+    for (std::thread &t : threadVector) {
+      if (t.joinable()) {
+        t.join();
+      }
+    }
+  };
+
+  try {
+    for (size_t i = 0; i < paths.size(); ++i) {
+      std::unique_lock<std::mutex> lock(readMutex);
+      readCondition.wait(lock, [&]() { return !completed.empty(); });
+      auto [index, buffer] = std::move(completed.front());
+      completed.pop();
+      readCondition.notify_all();
+      lock.unlock();
+
+      onRead(index, buffer);
+    }
+  } catch (...) {
+    // The threads have to be joined before the exception can go any further
+    stop();
+    throw;
+  }
+
+  stop();
+}
+
+std::vector<uchar> BulkReader::readFile(const std::string &path) {
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file) {
+    return {};
+  }
+
+  std::streamsize size = file.tellg();
+  if (size <= 0) {
+    return {};
+  }
+
+  std::vector<uchar> buffer(size);
+  file.seekg(0);
+  if (!file.read((char *)buffer.data(), size)) {
+    return {};
+  }
+
+  return buffer;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <condition_variable>
+#include <fstream>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "../precompiled.h"
+#include "../config.h"
+
+// Reads whole files into memory with lots of reads in flight at once, so that
+// slow disks are limited by throughput rather than by latency. Uses io_uring
+// where it's available and falls back to a pool of threads doing blocking
+// reads. The encoded buffers are meant to be handed to cv::imdecode.
+class BulkReader {
+public:
+  // Buffer is empty if the file couldn't be read. It's fine to move from it
+  typedef std::function<void(size_t index, std::vector<uchar> &buffer)>
+      on_read_fn;
+
+private:
+  int queueDepth;
+
+#ifdef HAVE_LIBURING
+  bool readWithUring(const std::vector<std::string> &paths,
+                     const on_read_fn &onRead);
+#endif
+  void readWithThreads(const std::vector<std::string> &paths,
+                       const on_read_fn &onRead);
+
+public:
+  BulkReader(int queueDepth = BULK_READER_QUEUE_DEPTH);
+
+  // onRead is called on the calling thread as each file finishes, which won't
+  // necessarily be in the order the paths were given in
+  void read(const std::vector<std::string> &paths, const on_read_fn &onRead);
+
+  static std::vector<uchar> readFile(const std::string &path);
+};
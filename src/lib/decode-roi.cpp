@@ -0,0 +1,113 @@
+#include "decode-roi.hpp"
+
+#ifdef HAVE_LIBJPEG_TURBO
+#include <csetjmp>
+#include <jpeglib.h>
+
+struct JpegErrorManager {
+  jpeg_error_mgr pub;
+  jmp_buf jump;
+};
+
+static void jpegErrorExit(j_common_ptr cinfo) {
+  longjmp(((JpegErrorManager *)cinfo->err)->jump, 1);
+}
+
+static void jpegOutputMessage(j_common_ptr cinfo) {}
+
+// libjpeg reports errors by calling error_exit, which jumps back here. Nothing
+// in this function has a destructor so that's safe: `out` belongs to the
+// caller and is only written through its pointer
+static bool decodeRoiInto(const std::vector<uchar> &encoded, cv::Rect roi,
+                          cv::Size minSize, cv::Mat *out) {
+  jpeg_decompress_struct cinfo;
+  JpegErrorManager error;
+  cinfo.err = jpeg_std_error(&error.pub);
+  error.pub.error_exit = jpegErrorExit;
+  error.pub.output_message = jpegOutputMessage;
+
+  if (setjmp(error.jump)) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, encoded.data(), encoded.size());
+  jpeg_read_header(&cinfo, TRUE);
+
+  if (roi.x < 0 || roi.y < 0 || roi.width <= 0 || roi.height <= 0 ||
+      roi.x + roi.width > (int)cinfo.image_width ||
+      roi.y + roi.height > (int)cinfo.image_height) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+
+  // The smallest of 1/8, 1/4, 1/2 and 1 that's still big enough
+  int scaleNum = 1;
+  while (scaleNum < 8 && (roi.width * scaleNum / 8 < minSize.width ||
+                          roi.height * scaleNum / 8 < minSize.height)) {
+    scaleNum *= 2;
+  }
+  cinfo.scale_num = scaleNum;
+  cinfo.scale_denom = 8;
+  cinfo.out_color_space = JCS_EXT_BGR;
+
+  jpeg_start_decompress(&cinfo);
+
+  // The ROI at the decoded scale
+  JDIMENSION left = (uint64_t)roi.x * cinfo.output_width / cinfo.image_width;
+  JDIMENSION top = (uint64_t)roi.y * cinfo.output_height / cinfo.image_height;
+  JDIMENSION right = std::min<JDIMENSION>(
+      cinfo.output_width,
+      ceil((double)(roi.x + roi.width) * cinfo.output_width /
+           cinfo.image_width));
+  JDIMENSION bottom = std::min<JDIMENSION>(
+      cinfo.output_height,
+      ceil((double)(roi.y + roi.height) * cinfo.output_height /
+           cinfo.image_height));
+
+  // Widened out to whole MCU columns, and output_width changes to match. An
+  // extra MCU on the right stops the last column being upsampled differently
+  // to a full decode
+  JDIMENSION mcuWidth = cinfo.max_h_samp_factor * cinfo.min_DCT_scaled_size;
+  JDIMENSION cropX = left;
+  JDIMENSION cropWidth =
+      std::min(right + mcuWidth, (JDIMENSION)cinfo.output_width) - left;
+  jpeg_crop_scanline(&cinfo, &cropX, &cropWidth);
+
+  if (top > 0) {
+    jpeg_skip_scanlines(&cinfo, top);
+  }
+
+  out->create(bottom - top, cinfo.output_width, CV_8UC3);
+  while (cinfo.output_scanline < bottom) {
+    JSAMPROW row = out->ptr<uchar>(cinfo.output_scanline - top);
+    jpeg_read_scanlines(&cinfo, &row, 1);
+  }
+
+  // Not finishing, as the rest of the scanlines are never read
+  jpeg_destroy_decompress(&cinfo);
+
+  *out = (*out)(cv::Rect(left - cropX, 0, right - left, bottom - top));
+  return true;
+}
+#endif
+
+cv::Mat decodeJpegRoi(const std::vector<uchar> &encoded, const ImageProbe &probe,
+                      cv::Rect roi, cv::Size minSize) {
+#ifdef HAVE_LIBJPEG_TURBO
+  // The ROI is in displayed coordinates, and the decoder only knows stored
+  // ones. Not worth translating for the odd rotated photo
+  if (probe.format != ImageFormat_Jpeg || probe.orientation != 1 ||
+      encoded.empty()) {
+    return cv::Mat();
+  }
+
+  cv::Mat decoded;
+  if (decodeRoiInto(encoded, roi, minSize, &decoded)) {
+    return decoded;
+  }
+#endif
+
+  return cv::Mat();
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "../precompiled.h"
+#include "../config.h"
+
+#include "probe-image.hpp"
+
+// Decodes just the part of a JPEG covering `roi` (in full resolution
+// coordinates), at the smallest DCT scale that leaves it at least `minSize`.
+// Only whole MCU rows and columns around the ROI are decoded.
+//
+// Returns an empty Mat if this can't be done - not a JPEG, an orientation
+// other than 1, libjpeg-turbo not available - in which case decode the whole
+// image instead.
+cv::Mat decodeJpegRoi(const std::vector<uchar> &encoded, const ImageProbe &probe,
+                      cv::Rect roi, cv::Size minSize);
@@ -1,11 +1,13 @@
 #include "detect-edge.hpp"
 
-static cv::Mat blurImage(const cv::Mat &sourceImage, int blurSize, int sigmaX,
-                         int sigmaY) {
+// originalSize is used for the aspect ratio so that images decoded at a reduced
+// resolution end up with exactly the same edge dimensions as full decodes
+static cv::Mat blurImage(const cv::Mat &sourceImage, cv::Size originalSize,
+                         int blurSize, int sigmaX, int sigmaY) {
   cv::Mat image, imageBlurred;
 
   int width = EDGE_DETECTION_WIDTH;
-  int height = (double)sourceImage.rows / sourceImage.cols * width;
+  int height = (double)originalSize.height / originalSize.width * width;
   cv::resize(sourceImage, image, {width, height});
   cv::GaussianBlur(image, imageBlurred, {blurSize, blurSize}, sigmaX, sigmaY);
 
@@ -15,7 +17,15 @@ static cv::Mat blurImage(const cv::Mat &sourceImage, int blurSize, int sigmaX,
 cv::Mat detectEdgesCanny(const cv::Mat &sourceImage, int blurSize, int sigmaX,
                          int sigmaY, int threshold1, int threshold2,
                          int joinByX, int joinByY) {
-  cv::Mat imageBlurred = blurImage(sourceImage, blurSize, sigmaX, sigmaY);
+  return detectEdgesCanny(sourceImage, sourceImage.size(), blurSize, sigmaX,
+                          sigmaY, threshold1, threshold2, joinByX, joinByY);
+}
+
+cv::Mat detectEdgesCanny(const cv::Mat &sourceImage, cv::Size originalSize,
+                         int blurSize, int sigmaX, int sigmaY, int threshold1,
+                         int threshold2, int joinByX, int joinByY) {
+  cv::Mat imageBlurred =
+      blurImage(sourceImage, originalSize, blurSize, sigmaX, sigmaY);
   cv::Mat imageCanny;
 
   cv::Canny(imageBlurred, imageCanny, threshold1, threshold2);
@@ -41,7 +51,8 @@ cv::Mat detectEdgesCanny(const cv::Mat &sourceImage, int blurSize, int sigmaX,
 
   cv::Mat imageResized;
   int finalWidth = STORED_EDGES_WIDTH;
-  int finalHeight = (double)sourceImage.rows / sourceImage.cols * finalWidth;
+  int finalHeight =
+      (double)originalSize.height / originalSize.width * finalWidth;
 
   cv::resize(imageCanny, imageResized, {finalWidth, finalHeight});
 
@@ -50,7 +61,15 @@ cv::Mat detectEdgesCanny(const cv::Mat &sourceImage, int blurSize, int sigmaX,
 
 cv::Mat detectEdgesThreshold(const cv::Mat &sourceImage, int blurSize,
                              int sigmaX, int sigmaY, int binaryThreshold) {
-  cv::Mat imageBlurred = blurImage(sourceImage, blurSize, sigmaX, sigmaY);
+  return detectEdgesThreshold(sourceImage, sourceImage.size(), blurSize, sigmaX,
+                              sigmaY, binaryThreshold);
+}
+
+cv::Mat detectEdgesThreshold(const cv::Mat &sourceImage, cv::Size originalSize,
+                             int blurSize, int sigmaX, int sigmaY,
+                             int binaryThreshold) {
+  cv::Mat imageBlurred =
+      blurImage(sourceImage, originalSize, blurSize, sigmaX, sigmaY);
   cv::Mat imageGray, imageThreshold;
 
   cv::cvtColor(imageBlurred, imageGray, cv::COLOR_BGR2GRAY);
@@ -63,7 +82,8 @@ cv::Mat detectEdgesThreshold(const cv::Mat &sourceImage, int blurSize,
   }
 
   int finalWidth = STORED_EDGES_WIDTH;
-  int finalHeight = (double)sourceImage.rows / sourceImage.cols * finalWidth;
+  int finalHeight =
+      (double)originalSize.height / originalSize.width * finalWidth;
 
   cv::resize(imageThreshold, imageResized, {finalWidth, finalHeight});
 
@@ -0,0 +1,118 @@
+#include "directory-watcher.hpp"
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+std::vector<std::string> DirectoryWatcher::waitForChanges(int debounceMs,
+                                                          int timeoutMs) {
+  std::vector<std::string> changed;
+
+  if (!readEvents(&changed, timeoutMs)) {
+    return changed;
+  }
+
+  // Keep collecting until the directory goes quiet
+  while (readEvents(&changed, debounceMs)) {
+  }
+
+  std::sort(changed.begin(), changed.end());
+  changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+
+  return changed;
+}
+
+DirectoryWatcher::DirectoryWatcher(const std::string &dirPath)
+    : DirectoryWatcher(std::vector<std::string>{dirPath}) {}
+
+#ifdef __linux__
+DirectoryWatcher::DirectoryWatcher(const std::vector<std::string> &dirPaths)
+    : dirPaths(dirPaths) {
+  inotifyFd = inotify_init1(IN_CLOEXEC);
+  if (inotifyFd < 0) {
+    throw std::runtime_error("Failed to initialise inotify");
+  }
+
+  for (const std::string &dirPath : dirPaths) {
+    // IN_CLOSE_WRITE rather than IN_CREATE so that we don't see files that
+    // are still being written
+    int watchFd = inotify_add_watch(inotifyFd, dirPath.c_str(),
+                                    IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (watchFd < 0) {
+      close(inotifyFd);
+      throw std::runtime_error("Failed to watch directory: " + dirPath);
+    }
+    watchedDirs[watchFd] = dirPath;
+  }
+}
+
+DirectoryWatcher::~DirectoryWatcher() { close(inotifyFd); }
+
+// Returns whether anything happened before the timeout
+bool DirectoryWatcher::readEvents(std::vector<std::string> *changed,
+                                  int timeoutMs) {
+  struct pollfd pollFd = {inotifyFd, POLLIN, 0};
+  if (poll(&pollFd, 1, timeoutMs) <= 0) {
+    return false;
+  }
+
+  alignas(struct inotify_event) char buffer[4096];
+  ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+  if (length <= 0) {
+    return false;
+  }
+
+  for (char *p = buffer; p < buffer + length;) {
+    auto *event = (struct inotify_event *)p;
+    auto dir = watchedDirs.find(event->wd);
+    if (event->len && !(event->mask & IN_ISDIR) && dir != watchedDirs.end()) {
+      std::filesystem::path path{dir->second};
+      path.append(event->name);
+      changed->push_back(path);
+    }
+    p += sizeof(struct inotify_event) + event->len;
+  }
+
+  return true;
+}
+#else
+DirectoryWatcher::DirectoryWatcher(const std::vector<std::string> &dirPaths)
+    : dirPaths(dirPaths) {
+  lastListing = listing();
+}
+
+DirectoryWatcher::~DirectoryWatcher() {}
+
+std::map<std::string, std::filesystem::file_time_type>
+DirectoryWatcher::listing() const {
+  std::map<std::string, std::filesystem::file_time_type> files;
+  for (const std::string &dirPath : dirPaths) {
+    for (const auto &file : std::filesystem::directory_iterator(dirPath)) {
+      if (file.is_regular_file()) {
+        files[file.path()] = file.last_write_time();
+      }
+    }
+  }
+  return files;
+}
+
+bool DirectoryWatcher::readEvents(std::vector<std::string> *changed,
+                                  int timeoutMs) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+
+  auto currentListing = listing();
+  bool anyChanged = false;
+  for (const auto &[name, modified] : currentListing) {
+    auto previous = lastListing.find(name);
+    if (previous == lastListing.end() || previous->second != modified) {
+      changed->push_back(name);
+      anyChanged = true;
+    }
+  }
+
+  lastListing = std::move(currentListing);
+  return anyChanged;
+}
+#endif
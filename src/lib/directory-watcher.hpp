@@ -0,0 +1,42 @@
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <vector>
+
+#include "../precompiled.h"
+#include "../config.h"
+
+// Watches directories (not recursively) for files being written or moved into
+// them. Uses inotify on Linux, and falls back to comparing directory listings
+// everywhere else.
+class DirectoryWatcher {
+  std::vector<std::string> dirPaths;
+
+#ifdef __linux__
+  int inotifyFd = -1;
+  std::map<int, std::string> watchedDirs;
+
+  bool readEvents(std::vector<std::string> *changed, int timeoutMs);
+#else
+  std::map<std::string, std::filesystem::file_time_type> lastListing;
+
+  std::map<std::string, std::filesystem::file_time_type> listing() const;
+  bool readEvents(std::vector<std::string> *changed, int timeoutMs);
+#endif
+
+public:
+  DirectoryWatcher(const std::string &dirPath);
+  DirectoryWatcher(const std::vector<std::string> &dirPaths);
+  ~DirectoryWatcher();
+  DirectoryWatcher(const DirectoryWatcher &) = delete;
+  DirectoryWatcher &operator=(const DirectoryWatcher &) = delete;
+
+  // Blocks until something changes and then nothing else has changed for
+  // debounceMs, so that a burst of files being copied in is returned in one
+  // go. Returns an empty list if nothing has changed after timeoutMs, so that
+  // callers get a chance to stop watching. Paths are the watched directory
+  // joined with the file name.
+  std::vector<std::string> waitForChanges(int debounceMs = WATCH_DEBOUNCE_MS,
+                                          int timeoutMs = 500);
+};
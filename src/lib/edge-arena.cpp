@@ -0,0 +1,237 @@
+#include "edge-arena.hpp"
+#include "edged-image.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// File layout of a `.edges` file: magic, image count, hash of the store, then
+// an offset and edge count per image, then the packed edges with each image
+// starting on a cache line. Offsets are from the start of the file
+static const char edgesFileMagic[8] = {'A', 'S', 'E', 'D', 'G', 'E', '0', '2'};
+static const size_t edgesHeaderSize = 24;
+
+static size_t roundUp(size_t value, size_t multiple) {
+  return (value + multiple - 1) / multiple * multiple;
+}
+
+EdgeArena::EdgeArena(size_t bytes, bool hugePages) {
+  capacity = roundUp(std::max(bytes, (size_t)64), 64);
+
+#ifdef __linux__
+  // Explicit huge pages have to be reserved by the system, so this fails more
+  // often than not - transparent huge pages are the fallback
+  if (hugePages) {
+    size_t hugeCapacity = roundUp(capacity, 2 << 20);
+    void *hugeData =
+        mmap(nullptr, hugeCapacity, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (hugeData != MAP_FAILED) {
+      data = (uchar *)hugeData;
+      capacity = hugeCapacity;
+      this->hugePages = true;
+      mapped = true;
+      return;
+    }
+
+    capacity = roundUp(capacity, 2 << 20);
+  }
+#endif
+
+  data = (uchar *)std::aligned_alloc(hugePages ? 2 << 20 : 64, capacity);
+  if (!data) {
+    throw std::bad_alloc();
+  }
+
+#ifdef __linux__
+  if (hugePages) {
+    this->hugePages = madvise(data, capacity, MADV_HUGEPAGE) == 0;
+  }
+#endif
+}
+
+EdgeArena::~EdgeArena() {
+  if (mapped) {
+    munmap(data, capacity);
+  } else {
+    std::free(data);
+  }
+}
+
+std::shared_ptr<EdgeArena>
+EdgeArena::adopt(const std::vector<std::shared_ptr<EdgedImage>> &images,
+                 bool hugePages) {
+  size_t bytes = 0;
+  for (const std::shared_ptr<EdgedImage> &image : images) {
+    bytes += roundUp((image->edgeCount() + 7) / 8, 64);
+  }
+
+  // Constructor is private, so no make_shared
+  std::shared_ptr<EdgeArena> arena(new EdgeArena(bytes, hugePages));
+  arena->offsets.reserve(images.size());
+  arena->edgeCounts.reserve(images.size());
+
+  size_t offset = 0;
+  for (const std::shared_ptr<EdgedImage> &image : images) {
+    image->copyPackedEdges(arena->data + offset);
+
+    arena->offsets.push_back(offset);
+    arena->edgeCounts.push_back(image->edgeCount());
+
+    offset += roundUp((image->edgeCount() + 7) / 8, 64);
+  }
+
+  for (size_t i = 0; i < images.size(); ++i) {
+    images[i]->viewEdges(arena, arena->edgesAt(i), arena->edgeCounts[i]);
+  }
+
+  return arena;
+}
+
+// FNV-1a, which is plenty to tell whether a store has been rewritten
+uint64_t EdgeArena::storeHash(const std::string &storeText) {
+  uint64_t hash = 14695981039346656037ull;
+  for (unsigned char c : storeText) {
+    hash = (hash ^ c) * 1099511628211ull;
+  }
+  return hash;
+}
+
+// Returns nullptr if the file doesn't exist or doesn't look right. Only the
+// offsets and edge counts are filled in: the rest is left for the store
+std::shared_ptr<EdgeArena> EdgeArena::map(const std::string &path,
+                                          uint64_t storeHash) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) < 0 || fileStat.st_size < edgesHeaderSize) {
+    close(fd);
+    return nullptr;
+  }
+
+  void *mappedData =
+      mmap(nullptr, fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mappedData == MAP_FAILED) {
+    return nullptr;
+  }
+
+  std::shared_ptr<EdgeArena> arena(new EdgeArena());
+  arena->data = (uchar *)mappedData;
+  arena->capacity = fileStat.st_size;
+  arena->mapped = true;
+  arena->fileBacked = true;
+
+  if (memcmp(arena->data, edgesFileMagic, 8) != 0) {
+    return nullptr;
+  }
+
+  // Left over from a different version of the store, e.g. one whose save
+  // didn't finish
+  uint64_t count, writtenHash;
+  memcpy(&count, arena->data + 8, 8);
+  memcpy(&writtenHash, arena->data + 16, 8);
+  if (writtenHash != storeHash ||
+      edgesHeaderSize + count * 16 > arena->capacity) {
+    return nullptr;
+  }
+
+  arena->offsets.resize(count);
+  arena->edgeCounts.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    uint64_t entry[2];
+    memcpy(entry, arena->data + edgesHeaderSize + i * 16, 16);
+    if (entry[0] + (entry[1] + 7) / 8 > arena->capacity) {
+      return nullptr;
+    }
+    arena->offsets[i] = entry[0];
+    arena->edgeCounts[i] = entry[1];
+  }
+
+  return arena;
+}
+
+// Whether the file at path was written with the store that hashes to
+// storeHash, so writing it again would change nothing
+bool EdgeArena::writtenWith(const std::string &path, uint64_t storeHash) {
+  std::ifstream file(path, std::ios::binary);
+  char header[edgesHeaderSize];
+  if (!file.read(header, edgesHeaderSize)) {
+    return false;
+  }
+
+  uint64_t writtenHash;
+  memcpy(&writtenHash, header + 16, 8);
+  return memcmp(header, edgesFileMagic, 8) == 0 && writtenHash == storeHash;
+}
+
+void EdgeArena::write(const std::string &path,
+                      const std::vector<EdgedImage *> &images,
+                      uint64_t storeHash) {
+  std::ofstream file(path, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error("Failed to open edges file.");
+  }
+
+  uint64_t count = images.size();
+  file.write(edgesFileMagic, 8);
+  file.write((const char *)&count, 8);
+  file.write((const char *)&storeHash, 8);
+
+  uint64_t offset = roundUp(edgesHeaderSize + count * 16, 64);
+  for (EdgedImage *image : images) {
+    uint64_t entry[2] = {offset, image->edgeCount()};
+    file.write((const char *)entry, 16);
+    offset += roundUp((image->edgeCount() + 7) / 8, 64);
+  }
+
+  std::vector<uchar> packed;
+  file.seekp(roundUp(edgesHeaderSize + count * 16, 64));
+  for (EdgedImage *image : images) {
+    packed.assign(roundUp((image->edgeCount() + 7) / 8, 64), 0);
+    image->copyPackedEdges(packed.data());
+    file.write((const char *)packed.data(), packed.size());
+  }
+
+  if (!file) {
+    throw std::runtime_error("Failed to write edges file.");
+  }
+}
+
+// Hints to the kernel that a range of a file backed arena is about to be
+// read, or that it won't be needed for a while and can be dropped from
+// memory (it stays in the page cache)
+void EdgeArena::advise(const uchar *begin, const uchar *end, bool willNeed) {
+  static const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+
+  uintptr_t first = (uintptr_t)begin / pageSize * pageSize;
+  uintptr_t last = roundUp((uintptr_t)end, pageSize);
+  if (!willNeed) {
+    // Don't drop pages that are shared with neighbouring ranges
+    first = roundUp((uintptr_t)begin, pageSize);
+    last = (uintptr_t)end / pageSize * pageSize;
+  }
+
+  if (last <= first) {
+    return;
+  }
+
+  madvise((void *)first, last - first,
+          willNeed ? MADV_WILLNEED : MADV_DONTNEED);
+}
+
+const uchar *EdgeArena::edgesAt(size_t i) const { return data + offsets[i]; }
+
+size_t EdgeArena::count() const { return offsets.size(); }
+
+size_t EdgeArena::bytes() const {
+  return capacity + count() * sizeof(size_t) * 2;
+}
+
+bool EdgeArena::usingHugePages() const { return hugePages; }
+
+bool EdgeArena::isFileBacked() const { return fileBacked; }
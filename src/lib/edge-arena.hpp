@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdlib>
+#include <fstream>
+
+#include "../precompiled.h"
+#include "../config.h"
+
+class EdgedImage;
+
+// Keeps the packed edges of a whole store in one contiguous block of memory,
+// with each image starting on its own cache line, so that a scan over the
+// store walks memory in order rather than chasing a pointer per image. Only the
+// edges live here: each image's offset and edge count sit in parallel arrays
+// alongside, and everything else stays on the EdgedImage.
+//
+// EdgedImages adopted by an arena drop their own bitset and become views into
+// it, keeping it alive for as long as they exist.
+//
+// An arena can also be a read-only memory map of a store's `.edges` file, in
+// which case the edges are only paged in as they're used. The file records a
+// hash of the store it was written with, and is only mapped if it still
+// matches.
+class EdgeArena {
+  uchar *data = nullptr;
+  size_t capacity = 0;
+  bool hugePages = false;
+  bool mapped = false;
+  bool fileBacked = false;
+
+  EdgeArena() {}
+  EdgeArena(size_t bytes, bool hugePages);
+
+public:
+  std::vector<size_t> offsets;
+  std::vector<size_t> edgeCounts;
+
+  ~EdgeArena();
+  EdgeArena(const EdgeArena &) = delete;
+  EdgeArena &operator=(const EdgeArena &) = delete;
+
+  static std::shared_ptr<EdgeArena>
+  adopt(const std::vector<std::shared_ptr<EdgedImage>> &images,
+        bool hugePages = EDGE_ARENA_HUGE_PAGES);
+
+  static uint64_t storeHash(const std::string &storeText);
+  static std::shared_ptr<EdgeArena> map(const std::string &path,
+                                        uint64_t storeHash);
+  static bool writtenWith(const std::string &path, uint64_t storeHash);
+  static void write(const std::string &path,
+                    const std::vector<EdgedImage *> &images,
+                    uint64_t storeHash);
+  static void advise(const uchar *begin, const uchar *end, bool willNeed);
+
+  const uchar *edgesAt(size_t i) const;
+  size_t count() const;
+  size_t bytes() const;
+  bool usingHugePages() const;
+  bool isFileBacked() const;
+};
@@ -0,0 +1,160 @@
+#include "edge-runs.hpp"
+
+// Lengths are written five bits to a character, lowest first, with 32 added
+// to every character but the last. Starting from '0', that never reaches a
+// comma or a newline, so it fits in a store field as is
+static void writeLength(std::string &str, size_t length) {
+  do {
+    int digit = length & 31;
+    length >>= 5;
+    str += (char)('0' + digit + (length ? 32 : 0));
+  } while (length);
+}
+
+static size_t readLength(const char *&str) {
+  size_t length = 0;
+  int shift = 0;
+
+  while (true) {
+    int digit = *str - '0';
+    if (digit < 0 || digit >= 64 || shift > 40) {
+      throw std::runtime_error("Invalid edge runs in store.");
+    }
+    ++str;
+
+    length |= (size_t)(digit & 31) << shift;
+    shift += 5;
+
+    if (!(digit & 32)) {
+      return length;
+    }
+  }
+}
+
+EdgeRuns::EdgeRuns(const uchar *packed, size_t count, int cols)
+    : _cols(cols), _count(count) {
+  if (cols <= 0 || cols > UINT16_MAX) {
+    throw std::runtime_error("Edge runs can't be this wide.");
+  }
+
+  rowStarts.reserve(rows() + 1);
+
+  for (int row = 0; row < rows(); ++row) {
+    rowStarts.push_back(runs.size());
+
+    size_t rowStart = (size_t)row * cols;
+    size_t rowEnd = std::min(count, rowStart + cols);
+    int start = -1;
+
+    for (size_t i = rowStart; i < rowEnd; ++i) {
+      // Most bytes are empty, so skip them whole where we can
+      if (start < 0 && i % 8 == 0 && i + 8 <= rowEnd && !packed[i / 8]) {
+        i += 7;
+        continue;
+      }
+
+      bool edge = (packed[i / 8] >> (i % 8)) & 1;
+      if (edge && start < 0) {
+        start = i - rowStart;
+      } else if (!edge && start >= 0) {
+        runs.push_back(start);
+        runs.push_back(i - rowStart);
+        start = -1;
+      }
+    }
+
+    if (start >= 0) {
+      runs.push_back(start);
+      runs.push_back(rowEnd - rowStart);
+    }
+  }
+
+  rowStarts.push_back(runs.size());
+  runs.shrink_to_fit();
+}
+
+// Alternating lengths of empty and edge pixels, in the same order as the bits
+// of a bitset. The row structure isn't stored: it comes back from `cols`
+EdgeRuns EdgeRuns::fromString(const char *str, size_t count, int cols) {
+  std::vector<uchar> packed((count + 7) / 8, 0);
+
+  size_t position = 0;
+  while (*str) {
+    position += readLength(str);
+    size_t length = readLength(str);
+    if (position + length > count) {
+      throw std::runtime_error("Invalid edge runs in store.");
+    }
+
+    for (size_t i = position; i < position + length; ++i) {
+      packed[i / 8] |= 1 << (i % 8);
+    }
+    position += length;
+  }
+
+  return EdgeRuns(packed.data(), count, cols);
+}
+
+std::string EdgeRuns::toString() const {
+  std::string str;
+  size_t position = 0;
+
+  for (int row = 0; row < rows(); ++row) {
+    for (const uint16_t *run = rowBegin(row); run != rowEnd(row); run += 2) {
+      size_t start = (size_t)row * _cols + run[0];
+      writeLength(str, start - position);
+      writeLength(str, run[1] - run[0]);
+      position = start + run[1] - run[0];
+    }
+  }
+
+  return str;
+}
+
+const uint16_t *EdgeRuns::rowBegin(int row) const {
+  return runs.data() + rowStarts[row];
+}
+
+const uint16_t *EdgeRuns::rowEnd(int row) const {
+  return runs.data() + rowStarts[row + 1];
+}
+
+// One byte per pixel, 255 for an edge and 0 otherwise
+void EdgeRuns::unpack(uchar *out) const {
+  memset(out, 0, _count);
+
+  for (int row = 0; row < rows(); ++row) {
+    uchar *rowOut = out + (size_t)row * _cols;
+    for (const uint16_t *run = rowBegin(row); run != rowEnd(row); run += 2) {
+      memset(rowOut + run[0], 255, run[1] - run[0]);
+    }
+  }
+}
+
+void EdgeRuns::pack(uchar *out) const {
+  memset(out, 0, (_count + 7) / 8);
+
+  for (int row = 0; row < rows(); ++row) {
+    size_t rowStart = (size_t)row * _cols;
+    for (const uint16_t *run = rowBegin(row); run != rowEnd(row); run += 2) {
+      for (size_t i = rowStart + run[0]; i < rowStart + run[1]; ++i) {
+        out[i / 8] |= 1 << (i % 8);
+      }
+    }
+  }
+}
+
+size_t EdgeRuns::count() const { return _count; }
+
+int EdgeRuns::cols() const { return _cols; }
+
+int EdgeRuns::rows() const {
+  return _cols ? (_count + _cols - 1) / _cols : 0;
+}
+
+size_t EdgeRuns::runCount() const { return runs.size() / 2; }
+
+size_t EdgeRuns::memoryBytes() const {
+  return sizeof(EdgeRuns) + rowStarts.capacity() * sizeof(uint32_t) +
+         runs.capacity() * sizeof(uint16_t);
+}
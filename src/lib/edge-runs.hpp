@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "../precompiled.h"
+#include "../config.h"
+
+// Edges stored as runs of edge pixels along each row. Edge maps are mostly
+// empty, so this is usually much smaller than a bit per pixel, and matching
+// can read it directly: each row's runs are sorted, so they can be walked
+// alongside the template.
+class EdgeRuns {
+  int _cols = 0;
+  size_t _count = 0;
+  // Index into `runs` of each row's first run, plus one past the end
+  std::vector<uint32_t> rowStarts;
+  // Start column and end column (exclusive) of each run, one after the other
+  std::vector<uint16_t> runs;
+
+public:
+  EdgeRuns() {}
+  // From edges packed least significant bit first, as in dynamic_bitset
+  EdgeRuns(const uchar *packed, size_t count, int cols = STORED_EDGES_WIDTH);
+
+  static EdgeRuns fromString(const char *str, size_t count,
+                             int cols = STORED_EDGES_WIDTH);
+  std::string toString() const;
+
+  const uint16_t *rowBegin(int row) const;
+  const uint16_t *rowEnd(int row) const;
+
+  void unpack(uchar *out) const;
+  void pack(uchar *out) const;
+
+  size_t count() const;
+  int cols() const;
+  int rows() const;
+  size_t runCount() const;
+  size_t memoryBytes() const;
+};
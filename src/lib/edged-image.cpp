@@ -1,5 +1,135 @@
 #include "edged-image.hpp"
 
+std::atomic_uint64_t EdgedImage::nextPlaneId(0);
+std::atomic_size_t EdgedImage::matchAllocations(0);
+std::atomic_size_t EdgedImage::warmStartsKept(0);
+std::atomic_size_t EdgedImage::warmStartsMissed(0);
+std::atomic_size_t EdgedImage::refineEvaluations(0);
+std::atomic_size_t EdgedImage::refinesImproved(0);
+std::atomic_size_t EdgedImage::sequentialPlacements(0);
+std::atomic_size_t EdgedImage::sequentialRejections(0);
+std::atomic_size_t EdgedImage::sequentialSamples(0);
+std::atomic_size_t EdgedImage::sequentialMisses(0);
+std::atomic_size_t EdgedImage::angleSearches(0);
+std::atomic_size_t EdgedImage::angleViews(0);
+
+typedef LruCache<uint64_t, std::vector<uchar>> PlaneCache;
+
+static PlaneCache &planeCache() {
+  static PlaneCache cache((size_t)MATCH_PLANE_CACHE_MB * 1048576);
+  return cache;
+}
+
+size_t EdgedImage::edgeCount() const {
+  if (_runs) {
+    return _runs->count();
+  }
+  return _packedEdges ? _edgeCount : edges.size();
+}
+
+// Writes one byte per pixel, 255 for an edge and 0 otherwise
+void EdgedImage::unpackEdges(uchar *out) const {
+  if (_runs) {
+    _runs->unpack(out);
+    return;
+  }
+
+  if (!_packedEdges) {
+    for (size_t i = 0; i < edges.size(); ++i) {
+      out[i] = edges[i] ? 255 : 0;
+    }
+    return;
+  }
+
+  // Blocks are stored least significant bit first, same as dynamic_bitset
+  static const auto lookup = []() {
+    std::array<std::array<uchar, 8>, 256> table;
+    for (int block = 0; block < 256; ++block) {
+      for (int bit = 0; bit < 8; ++bit) {
+        table[block][bit] = (block >> bit) & 1 ? 255 : 0;
+      }
+    }
+    return table;
+  }();
+
+  size_t fullBlocks = _edgeCount / 8;
+  for (size_t block = 0; block < fullBlocks; ++block) {
+    memcpy(out + block * 8, lookup[_packedEdges[block]].data(), 8);
+  }
+  for (size_t i = fullBlocks * 8; i < _edgeCount; ++i) {
+    out[i] = (_packedEdges[i / 8] >> (i % 8)) & 1 ? 255 : 0;
+  }
+}
+
+void EdgedImage::copyPackedEdges(uchar *out) const {
+  if (_runs) {
+    _runs->pack(out);
+  } else if (_packedEdges) {
+    memcpy(out, _packedEdges, (_edgeCount + 7) / 8);
+  } else {
+    boost::to_block_range(edges, out);
+  }
+}
+
+EdgedImage::bitset EdgedImage::edgeBitset() const {
+  if (!_packedEdges && !_runs) {
+    return edges;
+  }
+
+  std::vector<uchar> packed((edgeCount() + 7) / 8);
+  copyPackedEdges(packed.data());
+
+  bitset unpacked(packed.begin(), packed.end());
+  unpacked.resize(edgeCount());
+  return unpacked;
+}
+
+void EdgedImage::viewEdges(std::shared_ptr<const EdgeArena> arena,
+                           const uchar *packed, size_t count) {
+  _arena = std::move(arena);
+  _packedEdges = packed;
+  _edgeCount = count;
+  _runs.reset();
+  bitset().swap(edges);
+  _planeId = PlaneId();
+}
+
+void EdgedImage::useRuns(std::shared_ptr<const EdgeRuns> runs) {
+  _runs = std::move(runs);
+  _arena.reset();
+  _packedEdges = nullptr;
+  _edgeCount = 0;
+  bitset().swap(edges);
+  _planeId = PlaneId();
+}
+
+// Swaps whatever the edges are in for runs
+void EdgedImage::compressEdges() {
+  if (_runs) {
+    return;
+  }
+
+  std::vector<uchar> packed((edgeCount() + 7) / 8);
+  copyPackedEdges(packed.data());
+  useRuns(std::make_shared<EdgeRuns>(packed.data(), edgeCount()));
+}
+
+const EdgeRuns *EdgedImage::edgeRuns() const { return _runs.get(); }
+
+// Only set when the edges are in an arena
+const uchar *EdgedImage::packedEdges() const { return _packedEdges; }
+
+bool EdgedImage::edgesFileBacked() const {
+  return _arena && _arena->isFileBacked();
+}
+
+// Roughly what this image costs in memory, not counting anything in an arena
+size_t EdgedImage::memoryBytes() const {
+  return sizeof(EdgedImage) + path.capacity() +
+         edges.num_blocks() * sizeof(bitset::block_type) +
+         (_runs ? _runs->memoryBytes() : 0);
+}
+
 void EdgedImage::provideMatchContext(int templateOffsetX, int templateOffsetY) {
   _matchContextOffsetX = templateOffsetX;
   _matchContextOffsetY = templateOffsetY;
@@ -9,43 +139,315 @@ void EdgedImage::resetMatchContext() {
   _matchContextOffsetY = 0;
 }
 
+void EdgedImage::provideMatchOptions(const MatchOptions &options) {
+  _matchOptions = options;
+}
+
+// Outline scores aren't comparable with pixel scores, and the outline isn't
+// turned or rotated, so it's only matched when nothing else is searched
+bool canMatchOutline(const MatchOptions &options) {
+  return options.orientations == MatchOrientationSet_Upright &&
+         options.angleRange <= 0;
+}
+
+// Made for the same template, context and options as the next match
+// Matched instead of the template, which should be drawn from it. Only for
+// options that canMatchOutline
+void EdgedImage::provideVectorTemplate(
+    std::shared_ptr<const VectorTemplate> shapes) {
+  _vectorTemplate = std::move(shapes);
+}
+
+// Made by placedOutline for the same vector template and context as the next
+// match
+void EdgedImage::provideOutline(
+    std::shared_ptr<const std::vector<cv::Point2f>> outline) {
+  _outline = std::move(outline);
+}
+
+void EdgedImage::provideTemplateBank(
+    std::shared_ptr<const TemplateBank> bank) {
+  _templateBank = std::move(bank);
+}
+
+// Unpacked edges come from a cache shared by every query, so repeat queries
+// don't unpack the same images again. On a miss, the buffer is one the cache
+// is throwing out or this thread's last one, so nothing is allocated once
+// things are warm.
+//
+// Mapped edges skip the cache and are unpacked into this thread's buffer, as
+// the cache would hold them on top of the resident budget
+const uchar *EdgedImage::decodedEdges(MatchScratch *scratch) const {
+  if (edgesFileBacked()) {
+    // The last plane might still be in the cache, so can't be written over
+    if (!scratch->plane || scratch->plane.use_count() != 1) {
+      scratch->plane = std::make_shared<std::vector<uchar>>();
+    }
+    if (scratch->plane->capacity() < edgeCount()) {
+      matchAllocations++;
+    }
+
+    scratch->plane->resize(edgeCount());
+    unpackEdges(scratch->plane->data());
+    return scratch->plane->data();
+  }
+
+  std::shared_ptr<std::vector<uchar>> plane =
+      planeCache().get(_planeId.value);
+  if (plane) {
+    scratch->plane = std::move(plane);
+    return scratch->plane->data();
+  }
+
+  if (scratch->plane.use_count() == 1) {
+    plane = std::move(scratch->plane);
+  } else {
+    plane = planeCache().reclaim(edgeCount());
+  }
+
+  if (!plane || plane->capacity() < edgeCount()) {
+    matchAllocations++;
+  }
+  if (!plane) {
+    plane = std::make_shared<std::vector<uchar>>();
+  }
+
+  plane->resize(edgeCount());
+  unpackEdges(plane->data());
+
+  planeCache().put(_planeId.value, plane, plane->size());
+  scratch->plane = std::move(plane);
+  return scratch->plane->data();
+}
+
 int EdgedImage::matchTo(const cv::Mat &templateImageIn, ImageMatch *match,
                         float offsetScaleStep, int offsetXStep, int offsetYStep,
-                        float minOffsetScale, int maxOffset, float whiteBias) {
+                        float minOffsetScale, int maxOffset, float whiteBias,
+                        MatchScratch *scratch) {
   int channels = templateImageIn.channels();
   CV_Assert(channels == 1);
 
-  cv::Mat templateImage;
-  if (_matchContextOffsetX || _matchContextOffsetY) {
-    cv::Mat normalisedTemplateImage =
-        cv::Mat::zeros(templateImageIn.size(), templateImageIn.type());
+  MatchScratch localScratch;
+  if (!scratch) {
+    scratch = &localScratch;
+  }
+
+  if (_vectorTemplate && !canMatchOutline(_matchOptions)) {
+    throw std::runtime_error(
+        "Vector templates can only be matched upright, without angles.");
+  }
+
+  // Searching angles needs every rotation of the template, which are shared
+  // if matching a whole list
+  std::shared_ptr<const TemplateBank> bank = _templateBank;
+  if (!bank && _matchOptions.angleRange > 0) {
+    bank = std::make_shared<TemplateBank>(
+        templateImageIn, _matchContextOffsetX, _matchContextOffsetY,
+        _matchOptions.orientations, _matchOptions.angleRange,
+        _matchOptions.angleStep, _matchOptions.sequential);
+  }
+
+  cv::Mat shiftedTemplate;
+  if (bank) {
+    // Shifted already
+  } else if (_matchContextOffsetX || _matchContextOffsetY) {
+    // Only reallocates if the template changes size
+    const uchar *previousData = scratch->templateImage.data;
+    scratch->templateImage.create(templateImageIn.size(),
+                                  templateImageIn.type());
+    if (scratch->templateImage.data != previousData) {
+      matchAllocations++;
+    }
+
+    scratch->templateImage.setTo(0);
     int x1 = _matchContextOffsetX < 0 ? 0 : _matchContextOffsetX;
     int rectWidth = templateImageIn.cols - std::abs(_matchContextOffsetX);
     int y1 = _matchContextOffsetY < 0 ? 0 : _matchContextOffsetY;
     int rectHeight = templateImageIn.rows - std::abs(_matchContextOffsetY);
     templateImageIn(cv::Rect(x1, y1, rectWidth, rectHeight))
-        .copyTo(normalisedTemplateImage(cv::Rect(x1 - _matchContextOffsetX,
-                                                 y1 - _matchContextOffsetY,
-                                                 rectWidth, rectHeight)));
+        .copyTo(scratch->templateImage(cv::Rect(x1 - _matchContextOffsetX,
+                                                y1 - _matchContextOffsetY,
+                                                rectWidth, rectHeight)));
 
-    // todo fix these copies, especially the second one
-    templateImage = normalisedTemplateImage;
+    shiftedTemplate = scratch->templateImage;
   } else {
-    templateImage = templateImageIn;
+    shiftedTemplate = templateImageIn;
   }
 
+  int sourceImageActualHeight = (float)STORED_EDGES_WIDTH / width * height;
+
+  // The template turned whichever way round is being searched, and the canvas
+  // and context offset turned with it
+  cv::Mat templateImage;
+  int orientation = -1;
+  float angle = 0;
+  bool masked = false;
+  bool useOutline = (bool)_vectorTemplate;
+  std::shared_ptr<const std::vector<uint32_t>> sampleOrder;
+  int canvasWidth, canvasHeight;
+  int contextOffsetX, contextOffsetY;
+  float scaleX, scaleY, scaleBase;
+
+  auto useView = [&](const TemplateView &view) {
+    templateImage = view.image;
+    orientation = view.orientation;
+    angle = view.angle;
+    masked = view.masked;
+    // Views turned here, or from a bank made without them, reuse this
+    // thread's order for their size
+    sampleOrder = view.sampleOrder;
+    if (!sampleOrder && _matchOptions.sequential) {
+      auto &order = scratch->sampleOrders[{view.image.rows, view.image.cols}];
+      if (!order) {
+        order = shuffledPixels(view.image.size());
+      }
+      sampleOrder = order;
+    }
+    canvasWidth = view.canvasWidth;
+    canvasHeight = view.canvasHeight;
+    contextOffsetX = view.contextOffsetX;
+    contextOffsetY = view.contextOffsetY;
+
+    scaleX = (float)STORED_EDGES_WIDTH / templateImage.cols;
+    scaleY = (float)sourceImageActualHeight / templateImage.rows;
+    scaleBase = fmin(scaleX, scaleY);
+  };
+
+  // Without a bank, only quarter turns are searched, made here
+  auto orientTemplate = [&](int newOrientation) {
+    if (newOrientation == orientation) {
+      return;
+    }
+
+    TemplateView view;
+    view.orientation = newOrientation;
+
+    if (newOrientation == MatchOrientation_Upright) {
+      view.image = shiftedTemplate;
+    } else {
+      // Only reallocates if the turned template changes size
+      const uchar *previousData = scratch->orientedTemplate.data;
+      orientImage(shiftedTemplate, scratch->orientedTemplate, newOrientation);
+      if (scratch->orientedTemplate.data != previousData) {
+        matchAllocations++;
+      }
+      view.image = scratch->orientedTemplate;
+    }
+
+    cv::Size canvas =
+        orientedSize(cv::Size(CANVAS_WIDTH, CANVAS_HEIGHT), newOrientation);
+    view.canvasWidth = canvas.width;
+    view.canvasHeight = canvas.height;
+
+    cv::Point contextOffset = orientVector(
+        cv::Point(_matchContextOffsetX, _matchContextOffsetY), newOrientation);
+    view.contextOffsetX = contextOffset.x;
+    view.contextOffsetY = contextOffset.y;
+
+    useView(view);
+  };
+
+  auto useTemplate = [&](int newOrientation, float newAngle) {
+    if (bank) {
+      useView(bank->view(newOrientation, bank->angleIndex(newAngle)));
+    } else {
+      orientTemplate(newOrientation);
+    }
+  };
+  useTemplate(bank ? bank->orientations().front() : MatchOrientation_Upright,
+              0);
+
   // Converting to an array means we only have to do the bitwise operations
-  // required to access a bitset once per run
-  uchar edgesAry[edges.size()];
-  for (int i = 0; i < edges.size(); ++i) {
-    edgesAry[i] = edges[i] ? 255 : 0;
+  // required to access a bitset once per run. Runs are matched as they are,
+  // so don't need it unless there's an outline to match too
+  const uchar *edgesAry =
+      _runs && !_vectorTemplate ? nullptr : decodedEdges(scratch);
+
+  // The outline is shared if matching a whole list, and only the sums are
+  // made per image
+  std::shared_ptr<const std::vector<cv::Point2f>> outline = _outline;
+  if (_vectorTemplate) {
+    if (!outline) {
+      outline = _vectorTemplate->placedOutline(
+          _matchContextOffsetX, _matchContextOffsetY, templateImageIn.size());
+    }
+
+    // Only reallocates if the image changes size
+    const uchar *previousData = scratch->edgeSums.data;
+    int edgeRows = edgeCount() / STORED_EDGES_WIDTH;
+    cv::integral(
+        cv::Mat(edgeRows, STORED_EDGES_WIDTH, CV_8U, (void *)edgesAry),
+        scratch->edgeSums, CV_32S);
+    if (scratch->edgeSums.data != previousData) {
+      matchAllocations++;
+    }
   }
 
-  int sourceImageActualHeight = (float)STORED_EDGES_WIDTH / width * height;
-  float scaleX = (float)STORED_EDGES_WIDTH / templateImage.cols;
-  float scaleY = (float)sourceImageActualHeight / templateImage.rows;
+  // Edges along the outline are the edge pixels that match. Everything else
+  // the canvas covers is counted from the sums as the non-edge pixels, rather
+  // than one by one
+  auto outlineStep = [&](ImageMatch *stepMatch, float scale, int originX,
+                         int originY) {
+    int testedWhite = 0;
+    int matchingWhite = 0;
 
-  float scaleBase = fmin(scaleX, scaleY);
+    int lastX = -1, lastY = -1;
+    for (const cv::Point2f &point : *outline) {
+      int transformedX = originX + floor(point.x * scale);
+      int transformedY = originY + floor(point.y * scale);
+      if (transformedX == lastX && transformedY == lastY) {
+        continue;
+      }
+      lastX = transformedX;
+      lastY = transformedY;
+
+      ++testedWhite;
+      if (edgesAry[transformedY * STORED_EDGES_WIDTH + transformedX]) {
+        ++matchingWhite;
+      }
+    }
+
+    const cv::Mat &sums = scratch->edgeSums;
+    int x1 = std::max(originX, 0);
+    int y1 = std::max(originY, 0);
+    int x2 = std::min(
+        originX + (int)floor((templateImage.cols - 1) * scale) + 1,
+        sums.cols - 1);
+    int y2 = std::min(
+        originY + (int)floor((templateImage.rows - 1) * scale) + 1,
+        sums.rows - 1);
+
+    int area = 0, edges = 0;
+    if (x2 > x1 && y2 > y1) {
+      area = (x2 - x1) * (y2 - y1);
+      edges = (sums.at<int>(y2, x2) - sums.at<int>(y1, x2) -
+               sums.at<int>(y2, x1) + sums.at<int>(y1, x1)) /
+              255;
+    }
+
+    int testedBlack = std::max(area - testedWhite, 1);
+    int matchingBlack =
+        std::max(area - edges - (testedWhite - matchingWhite), 0);
+
+    float percentageBlack = (float)matchingBlack / testedBlack;
+    float percentageWhite = (float)matchingWhite / std::max(testedWhite, 1);
+    float percentage =
+        percentageWhite * whiteBias + percentageBlack * (1 - whiteBias);
+    *stepMatch = ImageMatch{percentage, scale, originX, originY};
+  };
+
+  auto step = [&](ImageMatch *stepMatch, float scale, int originX, int originY,
+                  int rowStep, int colStep) {
+    if (useOutline) {
+      outlineStep(stepMatch, scale, originX, originY);
+    } else if (_runs) {
+      matchToStep(templateImage, *_runs, stepMatch, scale, originX, originY,
+                  rowStep, colStep, whiteBias, masked);
+    } else {
+      matchToStep(templateImage, edgesAry, stepMatch, scale, originX, originY,
+                  rowStep, colStep, whiteBias, masked);
+    }
+  };
 
   ImageMatch bestMatch;
 
@@ -54,99 +456,373 @@ int EdgedImage::matchTo(const cv::Mat &templateImageIn, ImageMatch *match,
   int runs = 0;
   int fullRuns = 0;
 
-  for (float offsetScale = 1; offsetScale >= minOffsetScale;
-       offsetScale -= offsetScaleStep) {
-    float scale = scaleBase * offsetScale;
-
-    int originX = 0;
-    int originY = 0;
+  // Where the template is centred at a scale, which offsets are relative to
+  auto originsFor = [&](float scale, int *originX, int *originY) {
+    *originX = 0;
+    *originY = 0;
 
     if (scaleX != 0) {
-      originX = (STORED_EDGES_WIDTH - templateImage.cols * scale) / 2;
+      *originX = (STORED_EDGES_WIDTH - templateImage.cols * scale) / 2;
     }
     if (scaleX != 0) {
-      originY = (sourceImageActualHeight - templateImage.rows * scale) / 2;
-    }
-
-    // todo vary step and max depending on scale?
-    int maxOffsetX = std::min(maxOffset, originX);
-    int maxOffsetY = std::min(maxOffset, originY);
-
-    for (int offsetXRoot = 0; offsetXRoot <= maxOffsetX;
-         offsetXRoot += offsetXStep) {
-      for (int offsetXMultiplier = -1; offsetXMultiplier <= 1;
-           offsetXMultiplier += 2) {
-        // Search inside out, e.g. 0 -1 1 -2 2 -3 3
-        int offsetX = offsetXRoot * offsetXMultiplier;
-
-        for (int offsetYRoot = 0; offsetYRoot <= maxOffsetY;
-             offsetYRoot += offsetYStep) {
-          for (int offsetYMultiplier = -1; offsetYMultiplier <= 1;
-               offsetYMultiplier += 2) {
-            int offsetY = offsetYRoot * offsetYMultiplier;
-
-            // Calculate if template offset is viable
-            {
-              float realScale = (float)width / STORED_EDGES_WIDTH;
-              int finalX = originX + offsetX - _matchContextOffsetX * scale;
-              int finalY = originY + offsetY - _matchContextOffsetY * scale;
-              cv::Rect roi;
-              roi.x = round(finalX * realScale);
-              roi.y = round(finalY * realScale);
-              roi.width = round(CANVAS_WIDTH * realScale * scale);
-              roi.height = round(CANVAS_HEIGHT * realScale * scale);
-
-              if (roi.x < 0 || roi.x + roi.width > width) {
+      *originY = (sourceImageActualHeight - templateImage.rows * scale) / 2;
+    }
+  };
+
+  // Keeps a match of the template shifted by the context offset, if it's the
+  // best so far
+  auto keepIfBest = [&](const ImageMatch &match, float scale) {
+    if (match.percentage > bestMatch.percentage) {
+      bestMatch = match;
+      bestMatch.originX -= contextOffsetX * scale;
+      bestMatch.originY -= contextOffsetY * scale;
+      bestMatch.orientation = orientation;
+      bestMatch.angle = angle;
+    }
+  };
+
+  enum { Tried, OutsideX, OutsideY };
+  auto tryOffset = [&](float scale, int originX, int originY, int offsetX,
+                       int offsetY) {
+    // Calculate if template offset is viable
+    {
+      float realScale = (float)width / STORED_EDGES_WIDTH;
+      int finalX = originX + offsetX - contextOffsetX * scale;
+      int finalY = originY + offsetY - contextOffsetY * scale;
+      cv::Rect roi;
+      roi.x = round(finalX * realScale);
+      roi.y = round(finalY * realScale);
+      roi.width = round(canvasWidth * realScale * scale);
+      roi.height = round(canvasHeight * realScale * scale);
+
+      if (roi.x < 0 || roi.x + roi.width > width) {
+        return OutsideX;
+      }
+      if (roi.y < 0 || roi.y + roi.height > height) {
+        return OutsideY;
+      }
+    }
+
+    // Outlines are cheap enough to match in full every time
+    if (useOutline) {
+      ImageMatch match;
+      outlineStep(&match, scale, originX + offsetX, originY + offsetY);
+      fullRuns++;
+      keepIfBest(match, scale);
+
+      runs++;
+      return Tried;
+    }
+
+    if (_matchOptions.sequential) {
+      // Nothing to beat yet on the first placement
+      float threshold = runs == 0 ? 0 : bestMatch.percentage;
+      ImageMatch match;
+      bool accepted =
+          _runs ? matchToSequential(templateImage, *sampleOrder, *_runs,
+                                    &match, scale, originX + offsetX,
+                                    originY + offsetY, threshold, whiteBias,
+                                    _matchOptions.errorRate, masked)
+                : matchToSequential(templateImage, *sampleOrder, edgesAry,
+                                    &match, scale, originX + offsetX,
+                                    originY + offsetY, threshold, whiteBias,
+                                    _matchOptions.errorRate, masked);
+
+      if (accepted) {
+        fullRuns++;
+        keepIfBest(match, scale);
+      } else if (_matchOptions.auditSequential) {
+        step(&match, scale, originX + offsetX, originY + offsetY, 1, 1);
+        if (match.percentage > threshold) {
+          sequentialMisses++;
+        }
+      }
+
+      runs++;
+      return Tried;
+    }
+
+    ImageMatch match;
+    if (runs != 0) {
+      step(&match, scale, originX + offsetX, originY + offsetY, 10, 1);
+
+      // If partial match on rows isn't good enough, run again on cols
+      if (match.percentage < 0.5 ||
+          match.percentage < bestMatch.percentage - 0.1) {
+        step(&match, scale, originX + offsetX, originY + offsetY, 1, 10);
+      }
+    }
+
+    if (runs == 0 || (match.percentage > 0.5 &&
+                      match.percentage > bestMatch.percentage - 0.1)) {
+      step(&match, scale, originX + offsetX, originY + offsetY, 1, 1);
+      fullRuns++;
+      keepIfBest(match, scale);
+    }
+
+    runs++;
+    return Tried;
+  };
+
+  auto fullSearch = [&]() {
+    for (float offsetScale = 1; offsetScale >= minOffsetScale;
+         offsetScale -= offsetScaleStep) {
+      float scale = scaleBase * offsetScale;
+
+      int originX, originY;
+      originsFor(scale, &originX, &originY);
+
+      // todo vary step and max depending on scale?
+      int maxOffsetX = std::min(maxOffset, originX);
+      int maxOffsetY = std::min(maxOffset, originY);
+
+      for (int offsetXRoot = 0; offsetXRoot <= maxOffsetX;
+           offsetXRoot += offsetXStep) {
+        for (int offsetXMultiplier = -1; offsetXMultiplier <= 1;
+             offsetXMultiplier += 2) {
+          // Search inside out, e.g. 0 -1 1 -2 2 -3 3
+          int offsetX = offsetXRoot * offsetXMultiplier;
+
+          for (int offsetYRoot = 0; offsetYRoot <= maxOffsetY;
+               offsetYRoot += offsetYStep) {
+            for (int offsetYMultiplier = -1; offsetYMultiplier <= 1;
+                 offsetYMultiplier += 2) {
+              int offsetY = offsetYRoot * offsetYMultiplier;
+
+              int result = tryOffset(scale, originX, originY, offsetX, offsetY);
+              if (result == OutsideX) {
                 // We're in the y loop so we can break here - will be invalid
                 // for every item in the loop
                 break;
               }
-              if (roi.y < 0 || roi.y + roi.height > height) {
-                continue;
-              }
-            }
 
-            ImageMatch match;
-            if (runs != 0) {
-              matchToStep(templateImage, edgesAry, &match, scale,
-                          originX + offsetX, originY + offsetY, 10, 1,
-                          whiteBias);
-
-              // If partial match on rows isn't good enough, run again on cols
-              if (match.percentage < 0.5 ||
-                  match.percentage < bestMatch.percentage - 0.1) {
-                matchToStep(templateImage, edgesAry, &match, scale,
-                            originX + offsetX, originY + offsetY, 1, 10,
-                            whiteBias);
+              if (offsetY == 0) {
+                break;
               }
             }
+          }
 
-            if (runs == 0 || (match.percentage > 0.5 &&
-                              match.percentage > bestMatch.percentage - 0.1)) {
-              matchToStep(templateImage, edgesAry, &match, scale,
-                          originX + offsetX, originY + offsetY, 1, 1, whiteBias);
-              fullRuns++;
+          // No need to multiply 0 by both -1 and 1
+          if (offsetX == 0) {
+            break;
+          }
+        }
+      }
+    }
+  };
 
-              if (match.percentage > bestMatch.percentage) {
-                bestMatch = match;
-                bestMatch.originX -= _matchContextOffsetX * scale;
-                bestMatch.originY -= _matchContextOffsetY * scale;
-              }
-            }
+  // Only the scales and offsets within MATCH_WARM_START_RADIUS steps of where
+  // the image matched last time
+  auto warmSearch = [&](const ImageMatch &seed) {
+    float seedOffsetScale = seed.scale / scaleBase;
+    float scaleRadius = (MATCH_WARM_START_RADIUS + 0.5f) * offsetScaleStep;
+    int radiusX = MATCH_WARM_START_RADIUS * offsetXStep;
+    int radiusY = MATCH_WARM_START_RADIUS * offsetYStep;
 
-            runs++;
+    for (float offsetScale = 1; offsetScale >= minOffsetScale;
+         offsetScale -= offsetScaleStep) {
+      if (std::abs(offsetScale - seedOffsetScale) > scaleRadius) {
+        continue;
+      }
+      float scale = scaleBase * offsetScale;
 
-            if (offsetY == 0) {
-              break;
-            }
+      int originX, originY;
+      originsFor(scale, &originX, &originY);
+
+      int maxOffsetX = std::min(maxOffset, originX);
+      int maxOffsetY = std::min(maxOffset, originY);
+
+      // The same place in the image, relative to this scale's origin
+      int seedOffsetX = seed.originX + contextOffsetX * scale - originX;
+      int seedOffsetY = seed.originY + contextOffsetY * scale - originY;
+
+      for (int offsetX = std::max(seedOffsetX - radiusX, -maxOffsetX);
+           offsetX <= std::min(seedOffsetX + radiusX, maxOffsetX);
+           offsetX += offsetXStep) {
+        for (int offsetY = std::max(seedOffsetY - radiusY, -maxOffsetY);
+             offsetY <= std::min(seedOffsetY + radiusY, maxOffsetY);
+             offsetY += offsetYStep) {
+          if (tryOffset(scale, originX, originY, offsetX, offsetY) ==
+              OutsideX) {
+            break;
           }
         }
+      }
+    }
+  };
+
+  // Matches the template at any scale and position, where the position is
+  // where the canvas goes like in ImageMatch. Returns the percentage, or -1 if
+  // it doesn't fit in the image
+  auto evaluate = [&](float scale, int x, int y) {
+    float realScale = (float)width / STORED_EDGES_WIDTH;
+    cv::Rect roi;
+    roi.x = round(x * realScale);
+    roi.y = round(y * realScale);
+    roi.width = round(canvasWidth * realScale * scale);
+    roi.height = round(canvasHeight * realScale * scale);
+    if (roi.x < 0 || roi.x + roi.width > width || roi.y < 0 ||
+        roi.y + roi.height > height || scale < scaleBase * minOffsetScale ||
+        scale > scaleBase) {
+      return -1.f;
+    }
+
+    ImageMatch match;
+    step(&match, scale, x + contextOffsetX * scale,
+         y + contextOffsetY * scale, 1, 1);
+    runs++;
+    refineEvaluations++;
+
+    if (match.percentage > bestMatch.percentage) {
+      bestMatch = match;
+      bestMatch.originX = x;
+      bestMatch.originY = y;
+      bestMatch.orientation = orientation;
+      bestMatch.angle = angle;
+    }
+    return match.percentage;
+  };
+
+  // Hill climbs from the best match in halving steps, starting from half the
+  // grid step, down to a single pixel
+  auto refineOffsets = [&]() {
+    int stepX = std::max(offsetXStep / 2, 1);
+    int stepY = std::max(offsetYStep / 2, 1);
+
+    while (true) {
+      ImageMatch from = bestMatch;
+      for (auto [dx, dy] : {std::pair(stepX, 0), std::pair(-stepX, 0),
+                            std::pair(0, stepY), std::pair(0, -stepY)}) {
+        evaluate(from.scale, from.originX + dx, from.originY + dy);
+      }
+
+      if (bestMatch.percentage > from.percentage) {
+        continue;
+      }
+      if (stepX == 1 && stepY == 1) {
+        break;
+      }
+      stepX = std::max(stepX / 2, 1);
+      stepY = std::max(stepY / 2, 1);
+    }
+  };
+
+  // Golden section search on scale within a grid step either side, keeping
+  // the centre of the template where it is
+  auto refineScale = [&]() {
+    const float ratio = 0.618034f;
+    ImageMatch from = bestMatch;
+    float centreX = from.originX + canvasWidth * from.scale / 2;
+    float centreY = from.originY + canvasHeight * from.scale / 2;
+
+    auto evaluateScale = [&](float scale) {
+      return evaluate(scale, round(centreX - canvasWidth * scale / 2),
+                      round(centreY - canvasHeight * scale / 2));
+    };
+
+    float low = from.scale - offsetScaleStep * scaleBase;
+    float high = from.scale + offsetScaleStep * scaleBase;
+    float a = high - ratio * (high - low);
+    float b = low + ratio * (high - low);
+    float scoreA = evaluateScale(a);
+    float scoreB = evaluateScale(b);
+
+    for (int i = 0; i < MATCH_REFINE_SCALE_ITERATIONS; ++i) {
+      if (scoreA > scoreB) {
+        high = b;
+        b = a;
+        scoreB = scoreA;
+        a = high - ratio * (high - low);
+        scoreA = evaluateScale(a);
+      } else {
+        low = a;
+        a = b;
+        scoreA = scoreB;
+        b = low + ratio * (high - low);
+        scoreB = evaluateScale(b);
+      }
+    }
+  };
 
-        // No need to multiply 0 by both -1 and 1
-        if (offsetX == 0) {
-          break;
+  // Every orientation searched shares the best match so far, so ones tried
+  // later are pruned against the best of the ones tried before
+  auto orientedSearch = [&]() {
+    if (!bank) {
+      for (int o = 0; o < MatchOrientation_Count; ++o) {
+        if (_matchOptions.orientations & (1 << o)) {
+          orientTemplate(o);
+          fullSearch();
         }
       }
+      return;
+    }
+
+    // With angles, every MATCH_ANGLE_COARSE_STEPS of them are searched in
+    // each orientation. Then the angles half way to the next either side of
+    // the best are, and so on until they're next to each other
+    int angleCount = bank->angleCount();
+    int zero = bank->angleIndex(0);
+    std::vector<bool> searched(MatchOrientation_Count * angleCount);
+    angleViews += bank->orientations().size() * angleCount;
+
+    auto searchAngle = [&](int o, int angleIndex) {
+      if (angleIndex < 0 || angleIndex >= angleCount ||
+          searched[o * angleCount + angleIndex]) {
+        return;
+      }
+      searched[o * angleCount + angleIndex] = true;
+      angleSearches++;
+
+      useView(bank->view(o, angleIndex));
+      fullSearch();
+    };
+
+    for (int o : bank->orientations()) {
+      for (int angleIndex = zero % MATCH_ANGLE_COARSE_STEPS;
+           angleIndex < angleCount; angleIndex += MATCH_ANGLE_COARSE_STEPS) {
+        searchAngle(o, angleIndex);
+      }
+    }
+
+    if (bestMatch.percentage == 0) {
+      return;
+    }
+    for (int gap = MATCH_ANGLE_COARSE_STEPS / 2; gap >= 1; gap /= 2) {
+      int best = bank->angleIndex(bestMatch.angle);
+      searchAngle(bestMatch.orientation, best - gap);
+      searchAngle(bestMatch.orientation, best + gap);
+    }
+  };
+
+  // The image's last match is usually close when consecutive templates are
+  // similar. If it's about as good here, that's taken as the match; if not,
+  // what was found still makes the full search prune harder
+  ImageMatch seed = lastMatch;
+  if (_matchOptions.warmStart && seed.percentage > 0 &&
+      _matchOptions.orientations & (1 << seed.orientation) &&
+      (bank || seed.angle == 0)) {
+    useTemplate(seed.orientation, seed.angle);
+    warmSearch(seed);
+
+    if (bestMatch.percentage >= seed.percentage - MATCH_WARM_START_TOLERANCE) {
+      warmStartsKept++;
+    } else {
+      warmStartsMissed++;
+      orientedSearch();
+    }
+  } else {
+    orientedSearch();
+  }
+
+  // Goes finer than the grid around the best match it found
+  if (_matchOptions.refine && bestMatch.percentage > 0) {
+    useTemplate(bestMatch.orientation, bestMatch.angle);
+    float gridBest = bestMatch.percentage;
+    refineScale();
+    refineOffsets();
+
+    if (bestMatch.percentage > gridBest) {
+      refinesImproved++;
     }
   }
 
@@ -158,7 +834,7 @@ int EdgedImage::matchTo(const cv::Mat &templateImageIn, ImageMatch *match,
 void EdgedImage::matchToStep(const cv::Mat &templateImage,
                              const uchar edgesAry[], ImageMatch *match,
                              float scale, int originX, int originY, int rowStep,
-                             int colStep, float whiteBias) const {
+                             int colStep, float whiteBias, bool masked) const {
   int testedBlack = 0;
   int matchingBlack = 0;
   int testedWhite = 0;
@@ -168,6 +844,9 @@ void EdgedImage::matchToStep(const cv::Mat &templateImage,
     const uchar *p = templateImage.ptr<uchar>(y);
 
     for (int x = 0; x < templateImage.cols; x += colStep) {
+      if (masked && p[x] == MATCH_TEMPLATE_OUTSIDE) {
+        continue;
+      }
       bool templatePixVal = p[x] != 0;
 
       int transformedX = originX + floor((float)x * scale);
@@ -196,42 +875,290 @@ void EdgedImage::matchToStep(const cv::Mat &templateImage,
   *match = ImageMatch{percentage, scale, originX, originY};
 }
 
-cv::Mat EdgedImage::edgesAsMatrix() const {
-  uchar edgesAry[edges.size()];
-  for (int i = 0; i < edges.size(); ++i) {
-    edgesAry[i] = edges[i] ? 255 : 0;
+// Same as above, but finds each pixel by walking the row's runs. The template
+// is sampled left to right, so the walk only ever goes forwards
+void EdgedImage::matchToStep(const cv::Mat &templateImage,
+                             const EdgeRuns &runs, ImageMatch *match,
+                             float scale, int originX, int originY, int rowStep,
+                             int colStep, float whiteBias, bool masked) const {
+  int testedBlack = 0;
+  int matchingBlack = 0;
+  int testedWhite = 0;
+  int matchingWhite = 0;
+
+  for (int y = 0; y < templateImage.rows; y += rowStep) {
+    const uchar *p = templateImage.ptr<uchar>(y);
+
+    int transformedY = originY + floor((float)y * scale);
+    const uint16_t *run = runs.rowBegin(transformedY);
+    const uint16_t *rowEnd = runs.rowEnd(transformedY);
+
+    for (int x = 0; x < templateImage.cols; x += colStep) {
+      if (masked && p[x] == MATCH_TEMPLATE_OUTSIDE) {
+        continue;
+      }
+      bool templatePixVal = p[x] != 0;
+
+      int transformedX = originX + floor((float)x * scale);
+      while (run != rowEnd && run[1] <= transformedX) {
+        run += 2;
+      }
+      bool sourcePixVal = run != rowEnd && run[0] <= transformedX;
+
+      if (templatePixVal == 1) {
+        if (templatePixVal == sourcePixVal) {
+          ++matchingWhite;
+        }
+        ++testedWhite;
+      } else {
+        if (templatePixVal == sourcePixVal) {
+          ++matchingBlack;
+        }
+        ++testedBlack;
+      }
+    }
+  }
+
+  float percentageBlack = (float)matchingBlack / testedBlack;
+  float percentageWhite = (float)matchingWhite / testedWhite;
+  float percentage =
+      percentageWhite * whiteBias + percentageBlack * (1 - whiteBias);
+  *match = ImageMatch{percentage, scale, originX, originY};
+}
+
+// Samples the template's pixels in a random order, checking at doubling
+// sample counts whether the score could still reach `threshold`. The score is
+// a weighted mean of how many edge and non-edge pixels match, so each mean is
+// bounded with Hoeffding's inequality, which holds when sampling without
+// replacement too. The error rate is split between both means at each check,
+// so the chance of rejecting a placement that would have reached the
+// threshold is at most `errorRate`.
+//
+// Returns false if the placement was rejected. Otherwise every pixel has been
+// sampled, and the percentage is exact
+template <typename SourcePixFn>
+static bool sequentialScore(const cv::Mat &templateImage,
+                            const std::vector<uint32_t> &order, float scale,
+                            int originX, int originY, float threshold,
+                            float whiteBias, float errorRate, bool masked,
+                            SourcePixFn sourcePix, float *percentage,
+                            size_t *samples) {
+  int total = order.size();
+
+  int checks = 0;
+  for (int k = MATCH_SEQUENTIAL_FIRST_CHECK; k < total; k *= 2) {
+    checks++;
+  }
+  float logTerm = std::log(2.f * std::max(checks, 1) / errorRate);
+
+  int testedBlack = 0;
+  int matchingBlack = 0;
+  int testedWhite = 0;
+  int matchingWhite = 0;
+
+  int nextCheck = MATCH_SEQUENTIAL_FIRST_CHECK;
+  for (int sample = 0; sample < total; ++sample) {
+    if (sample == nextCheck) {
+      nextCheck *= 2;
+
+      auto upperBound = [&](int matching, int tested) {
+        if (tested == 0) {
+          return 1.f;
+        }
+        return std::min(1.f, (float)matching / tested +
+                                 std::sqrt(logTerm / (2 * tested)));
+      };
+
+      float bound = upperBound(matchingWhite, testedWhite) * whiteBias +
+                    upperBound(matchingBlack, testedBlack) * (1 - whiteBias);
+      if (bound < threshold) {
+        *samples = sample;
+        return false;
+      }
+    }
+
+    int y = order[sample] / templateImage.cols;
+    int x = order[sample] % templateImage.cols;
+    uchar templatePix = templateImage.ptr<uchar>(y)[x];
+    if (masked && templatePix == MATCH_TEMPLATE_OUTSIDE) {
+      continue;
+    }
+    bool templatePixVal = templatePix != 0;
+
+    int transformedX = originX + floor((float)x * scale);
+    int transformedY = originY + floor((float)y * scale);
+    bool sourcePixVal = sourcePix(transformedX, transformedY);
+
+    if (templatePixVal == 1) {
+      if (templatePixVal == sourcePixVal) {
+        ++matchingWhite;
+      }
+      ++testedWhite;
+    } else {
+      if (templatePixVal == sourcePixVal) {
+        ++matchingBlack;
+      }
+      ++testedBlack;
+    }
+  }
+
+  float percentageBlack = (float)matchingBlack / testedBlack;
+  float percentageWhite = (float)matchingWhite / testedWhite;
+  *percentage = percentageWhite * whiteBias + percentageBlack * (1 - whiteBias);
+  *samples = total;
+  return true;
+}
+
+bool EdgedImage::matchToSequential(const cv::Mat &templateImage,
+                                   const std::vector<uint32_t> &order,
+                                   const uchar edgesAry[], ImageMatch *match,
+                                   float scale, int originX, int originY,
+                                   float threshold, float whiteBias,
+                                   float errorRate, bool masked) const {
+  float percentage;
+  size_t samples;
+  bool accepted = sequentialScore(
+      templateImage, order, scale, originX, originY, threshold, whiteBias,
+      errorRate, masked,
+      [&](int x, int y) { return edgesAry[y * STORED_EDGES_WIDTH + x] != 0; },
+      &percentage, &samples);
+
+  sequentialPlacements++;
+  sequentialSamples += samples;
+  if (!accepted) {
+    sequentialRejections++;
+    return false;
   }
 
+  *match = ImageMatch{percentage, scale, originX, originY};
+  return true;
+}
+
+// Pixels are sampled in any order, so each is found by a binary search of
+// its row's runs
+bool EdgedImage::matchToSequential(const cv::Mat &templateImage,
+                                   const std::vector<uint32_t> &order,
+                                   const EdgeRuns &runs, ImageMatch *match,
+                                   float scale, int originX, int originY,
+                                   float threshold, float whiteBias,
+                                   float errorRate, bool masked) const {
+  auto sourcePix = [&](int x, int y) {
+    const uint16_t *begin = runs.rowBegin(y);
+    int pairs = (runs.rowEnd(y) - begin) / 2;
+
+    // First run that ends after x
+    int low = 0, high = pairs;
+    while (low < high) {
+      int mid = (low + high) / 2;
+      if (begin[mid * 2 + 1] <= x) {
+        low = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+    return low < pairs && begin[low * 2] <= x;
+  };
+
+  float percentage;
+  size_t samples;
+  bool accepted =
+      sequentialScore(templateImage, order, scale, originX, originY,
+                      threshold, whiteBias, errorRate, masked, sourcePix,
+                      &percentage, &samples);
+
+  sequentialPlacements++;
+  sequentialSamples += samples;
+  if (!accepted) {
+    sequentialRejections++;
+    return false;
+  }
+
+  *match = ImageMatch{percentage, scale, originX, originY};
+  return true;
+}
+
+cv::Mat EdgedImage::edgesAsMatrix() const {
   int cols = STORED_EDGES_WIDTH;
-  int rows = edges.size() / cols;
+  int rows = edgeCount() / cols;
 
   cv::Mat mat(rows, cols, CV_8UC1);
-  memcpy(mat.data, edgesAry, edges.size() * sizeof(uchar));
+
+  // Copying from the cache is quicker than unpacking again
+  std::shared_ptr<std::vector<uchar>> plane =
+      planeCache().peek(_planeId.value);
+  if (plane) {
+    memcpy(mat.data, plane->data(), (size_t)rows * cols);
+  } else {
+    unpackEdges(mat.data);
+  }
 
   return mat;
 }
 
+size_t EdgedImage::matchAllocationCount() { return matchAllocations; }
+
+// Warm starts that found a match as good as last time, and ones that had to
+// search everything anyway
+std::pair<size_t, size_t> EdgedImage::warmStartCounts() {
+  return {warmStartsKept, warmStartsMissed};
+}
+
+// Evaluations spent refining, and matches that refining improved on
+std::pair<size_t, size_t> EdgedImage::refineCounts() {
+  return {refineEvaluations, refinesImproved};
+}
+
+SequentialStats EdgedImage::sequentialStats() {
+  return {sequentialPlacements, sequentialRejections, sequentialSamples,
+          sequentialMisses};
+}
+
+// Angles searched, and angles there were to search, over every orientation
+std::pair<size_t, size_t> EdgedImage::angleCounts() {
+  return {angleSearches, angleViews};
+}
+
+LruCacheStats EdgedImage::planeCacheStats() {
+  return planeCache().getStats();
+}
+
 // Cache in memory - takes surprisingly long to read from disk every time
 cv::Mat EdgedImage::getOriginal(bool cache) {
   if (!cache) {
     return cv::imread(path);
   }
 
-  if (!originalImage.empty()) {
-    return originalImage;
+  return ImageCache::shared().get(path);
+}
+
+// Edges are written as runs prefixed with an R where that's shorter than hex
+static std::string edgesToString(const EdgedImage &image) {
+  if (EDGE_RUNS_ON_DISK) {
+    std::string runs;
+    if (image.edgeRuns()) {
+      runs = image.edgeRuns()->toString();
+    } else {
+      std::vector<uchar> packed((image.edgeCount() + 7) / 8);
+      image.copyPackedEdges(packed.data());
+      runs = EdgeRuns(packed.data(), image.edgeCount()).toString();
+    }
+
+    if (runs.size() + 1 < (image.edgeCount() + 3) / 4) {
+      return 'R' + runs;
+    }
   }
 
-  originalImage = cv::imread(path);
-  return originalImage;
+  return bitsetToString(image.edgeBitset());
 }
 
 std::ostream &operator<<(std::ostream &os, const EdgedImage &image) {
   os << image.path << ',' << image.width << ',' << image.height << ','
-     << image.edges.size() << ',' << bitsetToString(image.edges) << ','
+     << image.edgeCount() << ',' << edgesToString(image) << ','
      << image.detectionMode << ',' << image.detectionBlurSize << ','
      << image.detectionBlurSigmaX << ',' << image.detectionBlurSigmaY << ','
      << image.detectionCannyThreshold1 << ',' << image.detectionCannyThreshold2
      << ',' << image.detectionBinaryThreshold << ','
-     << image.detectionCannyJoinByX << ',' << image.detectionCannyJoinByY;
+     << image.detectionCannyJoinByX << ',' << image.detectionCannyJoinByY
+     << ',' << image.orientation << ',' << image.serial;
   return os;
 }
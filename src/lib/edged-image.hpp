@@ -1,15 +1,81 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <map>
 
 #include "../precompiled.h"
 #include "../config.h"
 
 #include "bitset-serialise.hpp"
+#include "edge-arena.hpp"
+#include "edge-runs.hpp"
+#include "image-cache.hpp"
+#include "lru-cache.hpp"
+#include "match-orientation.hpp"
+#include "template-bank.hpp"
+#include "vector-template.hpp"
 
 struct ImageMatch {
   float percentage = 0, scale = 1;
   int originX = 0, originY = 0;
+  // Which way round the image matched, out of MatchOrientations. The origin
+  // and scale are of the turned canvas, in the image as it is
+  int orientation = MatchOrientation_Upright;
+  // Degrees anticlockwise the canvas is rotated by on top of the orientation,
+  // in which case the origin and scale are of its bounding box
+  float angle = 0;
+};
+
+// How to search, beyond the template and its steps
+struct MatchOptions {
+  // Search around each image's last match first, and stop there if it's
+  // still about as good
+  bool warmStart = false;
+  // Refine the best match on the grid with a golden section search on scale,
+  // then by hill climbing on offsets, finer than the grid goes
+  bool refine = false;
+  // Screen placements by sampling pixels until it's clear they can't beat the
+  // best so far, wrongly rejecting one that could with at most errorRate
+  // chance, instead of by matching every tenth row and column
+  bool sequential = false;
+  float errorRate = MATCH_SEQUENTIAL_ERROR_RATE;
+  // Also match rejected placements in full, to count wrong rejections
+  bool auditSequential = false;
+  // Orientations of the images to search, as MatchOrientationSets
+  int orientations = MatchOrientationSet_Upright;
+  // Also search angles up to this many degrees either side of each
+  // orientation, coarse to fine
+  float angleRange = 0;
+  float angleStep = MATCH_ANGLE_STEP;
+};
+
+bool canMatchOutline(const MatchOptions &options);
+
+struct SequentialStats {
+  size_t placements = 0, rejections = 0, samples = 0, misses = 0;
+};
+
+// Buffers reused from one call of EdgedImage::matchTo to the next. Each
+// thread needs its own
+struct MatchScratch {
+  // The unpacked edges being matched, held so they can't be thrown out of the
+  // cache part way through
+  std::shared_ptr<std::vector<uchar>> plane;
+  cv::Mat templateImage;
+  cv::Mat orientedTemplate;
+  // For vector templates: running sums of the edges for counting them in any
+  // rectangle
+  cv::Mat edgeSums;
+  // Sample orders for templates turned here rather than taken from a bank,
+  // by size
+  std::map<std::pair<int, int>, std::shared_ptr<const std::vector<uint32_t>>>
+      sampleOrders;
+
+  MatchScratch() {}
+  // Copies start empty so that buffers are never shared
+  MatchScratch(const MatchScratch &) {}
+  MatchScratch &operator=(const MatchScratch &) { return *this; }
 };
 
 class EdgedImage {
@@ -18,11 +84,65 @@ class EdgedImage {
   void matchToStep(const cv::Mat &templateImage, const uchar edgesAry[],
                    ImageMatch *match, float scale, int originX, int originY,
                    int rowStep = 1, int colStep = 1,
-                   float whiteBias = MATCH_WHITE_BIAS) const;
+                   float whiteBias = MATCH_WHITE_BIAS,
+                   bool masked = false) const;
+  void matchToStep(const cv::Mat &templateImage, const EdgeRuns &runs,
+                   ImageMatch *match, float scale, int originX, int originY,
+                   int rowStep = 1, int colStep = 1,
+                   float whiteBias = MATCH_WHITE_BIAS,
+                   bool masked = false) const;
+
+  bool matchToSequential(const cv::Mat &templateImage,
+                         const std::vector<uint32_t> &order,
+                         const uchar edgesAry[], ImageMatch *match,
+                         float scale, int originX, int originY,
+                         float threshold, float whiteBias, float errorRate,
+                         bool masked = false) const;
+  bool matchToSequential(const cv::Mat &templateImage,
+                         const std::vector<uint32_t> &order,
+                         const EdgeRuns &runs, ImageMatch *match, float scale,
+                         int originX, int originY, float threshold,
+                         float whiteBias, float errorRate,
+                         bool masked = false) const;
 
-  cv::Mat originalImage;
   int _matchContextOffsetX;
   int _matchContextOffsetY;
+  MatchOptions _matchOptions;
+  std::shared_ptr<const TemplateBank> _templateBank;
+  std::shared_ptr<const VectorTemplate> _vectorTemplate;
+  std::shared_ptr<const std::vector<cv::Point2f>> _outline;
+
+  // When the edges live in an EdgeArena, `edges` is empty and these point
+  // into the arena instead
+  std::shared_ptr<const EdgeArena> _arena;
+  const uchar *_packedEdges = nullptr;
+  size_t _edgeCount = 0;
+  // Or when they're run length encoded, `edges` is empty and they're here
+  std::shared_ptr<const EdgeRuns> _runs;
+
+  // Identifies the edges in the decoded plane cache. Copies take a new one,
+  // as their edges can change without the original's, and so does swapping
+  // where the edges are held
+  static std::atomic_uint64_t nextPlaneId;
+  struct PlaneId {
+    uint64_t value = nextPlaneId++;
+
+    PlaneId() {}
+    PlaneId(const PlaneId &) {}
+    PlaneId &operator=(const PlaneId &) {
+      value = nextPlaneId++;
+      return *this;
+    }
+  };
+  PlaneId _planeId;
+  static std::atomic_size_t matchAllocations;
+  static std::atomic_size_t warmStartsKept, warmStartsMissed;
+  static std::atomic_size_t refineEvaluations, refinesImproved;
+  static std::atomic_size_t sequentialPlacements, sequentialRejections,
+      sequentialSamples, sequentialMisses;
+  static std::atomic_size_t angleSearches, angleViews;
+
+  const uchar *decodedEdges(MatchScratch *scratch) const;
 
   // @todo make this a bit more classey
 public:
@@ -34,6 +154,13 @@ public:
       detectionBlurSigmaY, detectionCannyThreshold1, detectionCannyThreshold2,
       detectionCannyJoinByX, detectionCannyJoinByY,detectionBinaryThreshold;
 
+  // EXIF orientation of the original, from the header probe
+  int orientation = 1;
+
+  // Numbers the image within its store, and is saved with it so that it never
+  // changes. -1 until an ImageList gives it one
+  int serial = -1;
+
   ImageMatch lastMatch;
 
   EdgedImage() {}
@@ -46,7 +173,8 @@ public:
              int detectionCannyThreshold2 = EDGE_DETECTION_CANNY_THRESHOLD_2,
              int detectionCannyJoinByX = EDGE_DETECTION_CANNY_JOIN_BY_X,
              int detectionCannyJoinByY = EDGE_DETECTION_CANNY_JOIN_BY_Y,
-             int detectionBinaryThreshold = EDGE_DETECTION_BINARY_THRESHOLD)
+             int detectionBinaryThreshold = EDGE_DETECTION_BINARY_THRESHOLD,
+             int orientation = 1)
       : path(path), width(width), height(height), edges(edges),
         detectionMode(detectionMode), detectionBlurSize(detectionBlurSize),
         detectionBlurSigmaX(detectionBlurSigmaX),
@@ -55,10 +183,28 @@ public:
         detectionCannyThreshold2(detectionCannyThreshold2),
         detectionCannyJoinByX(detectionCannyJoinByX),
         detectionCannyJoinByY(detectionCannyJoinByY),
-        detectionBinaryThreshold(detectionBinaryThreshold) {}
+        detectionBinaryThreshold(detectionBinaryThreshold),
+        orientation(orientation) {}
+
+  size_t edgeCount() const;
+  void unpackEdges(uchar *out) const;
+  void copyPackedEdges(uchar *out) const;
+  bitset edgeBitset() const;
+  void viewEdges(std::shared_ptr<const EdgeArena> arena, const uchar *packed,
+                 size_t count);
+  void useRuns(std::shared_ptr<const EdgeRuns> runs);
+  void compressEdges();
+  const EdgeRuns *edgeRuns() const;
+  const uchar *packedEdges() const;
+  bool edgesFileBacked() const;
+  size_t memoryBytes() const;
 
   void provideMatchContext(int templateOffsetX, int templateOffsetY);
   void resetMatchContext();
+  void provideMatchOptions(const MatchOptions &options);
+  void provideTemplateBank(std::shared_ptr<const TemplateBank> bank);
+  void provideVectorTemplate(std::shared_ptr<const VectorTemplate> shapes);
+  void provideOutline(std::shared_ptr<const std::vector<cv::Point2f>> outline);
 
   int matchTo(const cv::Mat &templateImage, ImageMatch *match,
               float offsetScaleStep = MATCH_OFFSET_SCALE_STEP,
@@ -66,8 +212,18 @@ public:
               int offsetYStep = MATCH_OFFSET_Y_STEP,
               float minOffsetScale = MATCH_MIN_OFFSET_SCALE,
               int maxOffset = MATCH_MAX_OFFSET,
-              float whiteBias = MATCH_WHITE_BIAS);
+              float whiteBias = MATCH_WHITE_BIAS,
+              MatchScratch *scratch = nullptr);
   cv::Mat edgesAsMatrix() const;
+
+  // Buffers allocated by matching, which should stop going up once the
+  // decoded plane cache and scratch buffers are warm
+  static size_t matchAllocationCount();
+  static std::pair<size_t, size_t> warmStartCounts();
+  static std::pair<size_t, size_t> refineCounts();
+  static SequentialStats sequentialStats();
+  static std::pair<size_t, size_t> angleCounts();
+  static LruCacheStats planeCacheStats();
   cv::Mat getOriginal(bool cache = true);
 
   friend std::ostream& operator<<(std::ostream& os, const EdgedImage& image);
@@ -21,7 +21,11 @@ std::optional<EdgedImage *> editImageEdges(EdgedImage &image) {
   int binaryThreshold = image.detectionBinaryThreshold;
   int manualEditMode = ManualEditMode_Line;
 
-  const cv::Mat sourceImage = cv::imread(image.path);
+  // Edges are detected at EDGE_DETECTION_WIDTH so there's no point decoding
+  // the full image - it's only used for the preview otherwise
+  const ReducedImage source = readImageReduced(image.path);
+  const cv::Mat &sourceImage = source.image;
+  const cv::Size sourceSize(source.width, source.height);
   cv::Mat templateImage = image.edgesAsMatrix();
 
   if (sourceImage.empty()) {
@@ -29,7 +33,7 @@ std::optional<EdgedImage *> editImageEdges(EdgedImage &image) {
   }
 
   std::string title = std::string("Editing ") + image.path;
-  initWindow(sourceImage.cols, sourceImage.rows, title.c_str());
+  initWindow(source.width, source.height, title.c_str());
   GLuint image_tex;
 
   ImVec2 mouseDownPos(-1, -1);
@@ -72,11 +76,11 @@ std::optional<EdgedImage *> editImageEdges(EdgedImage &image) {
     if (!initial) {
       if (detectionMode == ImageEdgeMode_Canny) {
         templateImage =
-            detectEdgesCanny(sourceImage, blurSize, sigmaX, sigmaY, threshold1,
-                             threshold2, joinByX, joinByY);
+            detectEdgesCanny(sourceImage, sourceSize, blurSize, sigmaX, sigmaY,
+                             threshold1, threshold2, joinByX, joinByY);
       } else if (detectionMode == ImageEdgeMode_Threshold) {
-        templateImage = detectEdgesThreshold(sourceImage, blurSize, sigmaX,
-                                             sigmaY, binaryThreshold);
+        templateImage = detectEdgesThreshold(sourceImage, sourceSize, blurSize,
+                                             sigmaX, sigmaY, binaryThreshold);
       } else if (drawing) {
         previewTemplateImage = templateImage;
       }
@@ -241,7 +245,11 @@ std::optional<EdgedImage *> editImageEdges(EdgedImage &image) {
   }
 
   auto edges = edgesToBitset(templateImage);
-  return new EdgedImage(image.path, image.width, image.height, edges,
-                        detectionMode, blurSize, sigmaX, sigmaY, threshold1,
-                        threshold2, joinByX, joinByY, binaryThreshold);
+  auto *edited = new EdgedImage(image.path, image.width, image.height, edges,
+                                detectionMode, blurSize, sigmaX, sigmaY,
+                                threshold1, threshold2, joinByX, joinByY,
+                                binaryThreshold, image.orientation);
+  // Still the same image, so it keeps its ID
+  edited->serial = image.serial;
+  return edited;
 }
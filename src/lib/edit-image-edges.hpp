@@ -6,6 +6,7 @@
 #include "detect-edge.hpp"
 #include "edged-image.hpp"
 #include "mat-to-texture.hpp"
+#include "read-image.hpp"
 #include "window.hpp"
 
 std::optional<EdgedImage*> editImageEdges(EdgedImage &image);
@@ -0,0 +1,344 @@
+#include <limits>
+#include <queue>
+
+#include "frame-assignment.hpp"
+
+Assignment assignGreedy(
+    const std::vector<std::vector<AssignmentCandidate>> &candidates) {
+  auto start = std::chrono::high_resolution_clock::now();
+
+  Assignment assignment;
+  std::vector<bool> used;
+
+  for (const std::vector<AssignmentCandidate> &frame : candidates) {
+    int chosen = -1;
+    for (int i = 0; i < frame.size(); ++i) {
+      if (frame[i].image >= used.size()) {
+        used.resize(frame[i].image + 1);
+      }
+
+      if (!used[frame[i].image]) {
+        chosen = i;
+        used[frame[i].image] = true;
+        assignment.totalScore += frame[i].score;
+        break;
+      }
+    }
+
+    assignment.chosen.push_back(chosen);
+    assignment.unassigned += chosen == -1;
+  }
+
+  std::chrono::duration<float> duration =
+      std::chrono::high_resolution_clock::now() - start;
+  assignment.seconds = duration.count();
+  return assignment;
+}
+
+// Frames are rows and images are columns, costing 1 - score. Each frame also
+// has a column of its own meaning "no image", which costs more than any set
+// of real candidates could save, so that there's always a way to assign a
+// frame and it's only taken when there's no other.
+//
+// Frames are added one at a time, each by the shortest path from it to a free
+// column through the frames already assigned, which swaps them to other
+// columns along the way. Column potentials keep the reduced costs positive so
+// that Dijkstra can be used for this
+AssignmentSolver::AssignmentSolver(
+    std::vector<std::vector<AssignmentCandidate>> candidates)
+    : candidates(std::move(candidates)) {
+  int rows = this->candidates.size();
+  missingCost = rows + 1;
+
+  potential.resize(rows, 0);
+  columnRow.resize(rows, -1);
+  rowColumn.resize(rows, -1);
+  rowArc.resize(rows, -1);
+  rowCost.resize(rows, 0);
+
+  for (int row = 0; row < rows; ++row) {
+    for (const AssignmentCandidate &candidate : this->candidates[row]) {
+      std::vector<int> &rows = imageRows.at(addColumns(candidate.image));
+      if (rows.empty() || rows.back() != row) {
+        rows.push_back(row);
+      }
+    }
+    freeRows.push_back(row);
+  }
+
+  solve();
+}
+
+// Makes sure there's a column for the image
+int AssignmentSolver::addColumns(int image) {
+  if (image >= imageRows.size()) {
+    imageRows.resize(image + 1);
+    int columns = candidates.size() + image + 1;
+    potential.resize(columns, 0);
+    columnRow.resize(columns, -1);
+  }
+  return image;
+}
+
+// Arc k of a row is its kth candidate, or its own column after the last
+int AssignmentSolver::arcColumn(int row, int k) const {
+  return k < candidates[row].size() ? candidates.size() + candidates[row][k].image
+                                    : row;
+}
+
+double AssignmentSolver::arcCost(int row, int k) const {
+  return k < candidates[row].size()
+             ? 1.0 - std::clamp(candidates[row][k].score, 0.f, 1.f)
+             : missingCost;
+}
+
+// Takes a frame's column away to be assigned again. A column left free must
+// have no potential, so any other frame that would then prefer the column is
+// released too
+void AssignmentSolver::release(int row) {
+  std::vector<int> releasing = {row};
+
+  while (!releasing.empty()) {
+    int releasedRow = releasing.back();
+    releasing.pop_back();
+
+    int column = rowColumn[releasedRow];
+    if (column == -1) {
+      continue;
+    }
+
+    rowColumn[releasedRow] = -1;
+    rowArc[releasedRow] = -1;
+    columnRow[column] = -1;
+    freeRows.push_back(releasedRow);
+
+    if (potential[column] == 0) {
+      continue;
+    }
+    potential[column] = 0;
+
+    if (column < candidates.size()) {
+      continue;
+    }
+    for (int other : imageRows[column - candidates.size()]) {
+      int otherColumn = rowColumn[other];
+      if (otherColumn == -1) {
+        continue;
+      }
+
+      double rowPotential = rowCost[other] - potential[otherColumn];
+      for (int k = 0; k < candidates[other].size(); ++k) {
+        if (arcColumn(other, k) == column &&
+            arcCost(other, k) - rowPotential < 0) {
+          releasing.push_back(other);
+          break;
+        }
+      }
+    }
+  }
+}
+
+// Replaces a frame's candidates. Its image is only taken away if it's no
+// longer a candidate, or if one of the new candidates might be better
+void AssignmentSolver::setCandidates(
+    int row, std::vector<AssignmentCandidate> rowCandidates) {
+  for (const AssignmentCandidate &candidate : candidates[row]) {
+    std::vector<int> &rows = imageRows[candidate.image];
+    rows.erase(std::remove(rows.begin(), rows.end(), row), rows.end());
+  }
+
+  int column = rowColumn[row];
+  candidates[row] = std::move(rowCandidates);
+  for (const AssignmentCandidate &candidate : candidates[row]) {
+    std::vector<int> &rows = imageRows.at(addColumns(candidate.image));
+    if (rows.empty() || rows.back() != row) {
+      rows.push_back(row);
+    }
+  }
+
+  if (column == -1) {
+    return;
+  }
+
+  // The row's potential, with the best arc to the column it has now
+  double rowPotential = std::numeric_limits<double>::infinity();
+  int bestArc = -1;
+  for (int k = 0; k <= candidates[row].size(); ++k) {
+    if (arcColumn(row, k) == column &&
+        arcCost(row, k) - potential[column] < rowPotential) {
+      rowPotential = arcCost(row, k) - potential[column];
+      bestArc = k;
+    }
+  }
+
+  bool keep = bestArc != -1;
+  for (int k = 0; keep && k <= candidates[row].size(); ++k) {
+    keep = arcCost(row, k) - potential[arcColumn(row, k)] >= rowPotential;
+  }
+
+  if (keep) {
+    rowArc[row] = bestArc;
+    rowCost[row] = arcCost(row, bestArc);
+  } else {
+    release(row);
+  }
+}
+
+void AssignmentSolver::augment(int freeRow) {
+  const double infinity = std::numeric_limits<double>::infinity();
+  int columns = potential.size();
+  dist.resize(columns, infinity);
+  pred.resize(columns, -1);
+  predArc.resize(columns, -1);
+  scanned.resize(columns, false);
+
+  std::vector<int> touched, scannedColumns;
+  typedef std::pair<double, int> heap_entry;
+  std::priority_queue<heap_entry, std::vector<heap_entry>,
+                      std::greater<heap_entry>>
+      heap;
+
+  auto relax = [&](int row, double base) {
+    for (int k = 0; k <= candidates[row].size(); ++k) {
+      int column = arcColumn(row, k);
+      if (scanned[column]) {
+        continue;
+      }
+
+      double d = base + arcCost(row, k) - potential[column];
+      if (d < dist[column]) {
+        if (dist[column] == infinity) {
+          touched.push_back(column);
+        }
+        dist[column] = d;
+        pred[column] = row;
+        predArc[column] = k;
+        heap.emplace(d, column);
+      }
+    }
+  };
+
+  relax(freeRow, 0);
+
+  // The row's own column is always free, so this always finds one
+  int sink = -1;
+  double sinkDist = 0;
+  while (!heap.empty()) {
+    auto [d, column] = heap.top();
+    heap.pop();
+    if (scanned[column] || d > dist[column]) {
+      continue;
+    }
+
+    scanned[column] = true;
+    scannedColumns.push_back(column);
+    sinkDist = d;
+
+    int row = columnRow[column];
+    if (row == -1) {
+      sink = column;
+      break;
+    }
+
+    // Costs along the row are relative to the column it has now
+    relax(row, d - (rowCost[row] - potential[column]));
+  }
+
+  for (int column : scannedColumns) {
+    potential[column] += dist[column] - sinkDist;
+  }
+
+  // Shift each frame along the path over to the column before it
+  for (int column = sink;;) {
+    int row = pred[column];
+    int previous = rowColumn[row];
+
+    columnRow[column] = row;
+    rowColumn[row] = column;
+    rowArc[row] = predArc[column];
+    rowCost[row] = arcCost(row, predArc[column]);
+
+    if (row == freeRow) {
+      break;
+    }
+    column = previous;
+  }
+
+  for (int column : touched) {
+    dist[column] = infinity;
+    scanned[column] = false;
+  }
+}
+
+// Assigns every frame that isn't, and returns the frames whose candidate
+// changed since last time. Frames whose candidates were replaced might be
+// among them with the same match as before, as their candidates moved
+std::vector<int> AssignmentSolver::solve() {
+  std::vector<int> rows = std::move(freeRows);
+  freeRows.clear();
+
+  std::sort(rows.begin(), rows.end());
+  rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+
+  for (int row : rows) {
+    augment(row);
+  }
+
+  std::vector<int> changed;
+  solvedArc.resize(candidates.size(), -1);
+  solvedColumn.resize(candidates.size(), -1);
+  for (int row = 0; row < candidates.size(); ++row) {
+    if (rowColumn[row] != solvedColumn[row] || rowArc[row] != solvedArc[row]) {
+      changed.push_back(row);
+      solvedColumn[row] = rowColumn[row];
+      solvedArc[row] = rowArc[row];
+    }
+  }
+  return changed;
+}
+
+// Index of the frame's candidate, or -1 if it has none
+int AssignmentSolver::chosen(int row) const {
+  return rowArc[row] >= 0 && rowArc[row] < candidates[row].size() ? rowArc[row]
+                                                                  : -1;
+}
+
+const std::vector<int> &AssignmentSolver::rowsWith(int image) const {
+  static const std::vector<int> none;
+  return image < imageRows.size() ? imageRows[image] : none;
+}
+
+Assignment AssignmentSolver::assignment() const {
+  Assignment assignment;
+  for (int row = 0; row < candidates.size(); ++row) {
+    int k = chosen(row);
+    assignment.chosen.push_back(k);
+    if (k == -1) {
+      assignment.unassigned++;
+    } else {
+      assignment.totalScore += candidates[row][k].score;
+    }
+  }
+  return assignment;
+}
+
+Assignment assignOptimal(
+    const std::vector<std::vector<AssignmentCandidate>> &candidates) {
+  auto start = std::chrono::high_resolution_clock::now();
+
+  Assignment assignment = AssignmentSolver(candidates).assignment();
+
+  std::chrono::duration<float> duration =
+      std::chrono::high_resolution_clock::now() - start;
+  assignment.seconds = duration.count();
+  return assignment;
+}
+
+std::ostream &operator<<(std::ostream &os, const Assignment &assignment) {
+  int assigned = assignment.chosen.size() - assignment.unassigned;
+  os << "total score " << assignment.totalScore << " (mean "
+     << (assigned ? assignment.totalScore / assigned * 100 : 0) << "%), "
+     << assignment.unassigned << " frames without an image, in "
+     << assignment.seconds << 's';
+  return os;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "../precompiled.h"
+#include "../config.h"
+
+// One image a frame could use, and how well it matches (higher is better)
+struct AssignmentCandidate {
+  int image;
+  float score;
+};
+
+struct Assignment {
+  // For each frame, the index of the candidate it uses, or -1 if every one of
+  // its candidates is needed by other frames
+  std::vector<int> chosen;
+  double totalScore = 0;
+  int unassigned = 0;
+  float seconds = 0;
+};
+
+// Gives each frame, in order, its first candidate that an earlier frame
+// isn't already using
+Assignment assignGreedy(
+    const std::vector<std::vector<AssignmentCandidate>> &candidates);
+
+// Maximises the total score with each image used at most once, and as few
+// frames as possible left without one. Solved as a min cost assignment with
+// successive shortest paths: Dijkstra over only the candidates each frame
+// has, so sparse candidate lists stay cheap however many images there are.
+//
+// The solution is kept, so that when a frame's candidates change only the
+// frames that have to move are assigned again. Scores are taken to be
+// between 0 and 1.
+class AssignmentSolver {
+  std::vector<std::vector<AssignmentCandidate>> candidates;
+  // Frames that have each image as a candidate
+  std::vector<std::vector<int>> imageRows;
+  double missingCost;
+
+  // Column r is frame r going without an image, and image i is column
+  // rows + i
+  std::vector<double> potential;
+  std::vector<int> columnRow, rowColumn, rowArc;
+  std::vector<double> rowCost;
+  std::vector<int> freeRows;
+  // As of the last solve, to tell what changed
+  std::vector<int> solvedColumn, solvedArc;
+
+  // Scratch for augment
+  std::vector<double> dist;
+  std::vector<int> pred, predArc;
+  std::vector<bool> scanned;
+
+  int arcColumn(int row, int k) const;
+  double arcCost(int row, int k) const;
+  int addColumns(int image);
+  void release(int row);
+  void augment(int freeRow);
+
+public:
+  AssignmentSolver(std::vector<std::vector<AssignmentCandidate>> candidates);
+
+  void setCandidates(int row, std::vector<AssignmentCandidate> rowCandidates);
+  std::vector<int> solve();
+
+  int chosen(int row) const;
+  const std::vector<int> &rowsWith(int image) const;
+  Assignment assignment() const;
+};
+
+Assignment assignOptimal(
+    const std::vector<std::vector<AssignmentCandidate>> &candidates);
+
+std::ostream &operator<<(std::ostream &os, const Assignment &assignment);
@@ -0,0 +1,143 @@
+#include "frame-cache.hpp"
+#include "bulk-reader.hpp"
+
+FrameCache::FrameCache(size_t budget, const std::string &spillDir)
+    : cache(budget), spillDir(spillDir), spillHits(0) {
+  if (!spillDir.empty()) {
+    std::filesystem::create_directories(spillDir);
+  }
+}
+
+FrameCache &FrameCache::shared() {
+  static FrameCache frameCache((size_t)FRAME_CACHE_MB * 1048576,
+                               FRAME_CACHE_SPILL_DIR);
+  return frameCache;
+}
+
+// Spilled frames are made from the frames and stores as they were, so if the
+// stamp describing them isn't the one the spill directory was made with,
+// everything in it is thrown away
+void FrameCache::validateSpill(const std::string &stamp) {
+  namespace fs = std::filesystem;
+
+  if (spillDir.empty()) {
+    return;
+  }
+
+  fs::path stampPath(spillDir);
+  stampPath.append(".stamp");
+  std::ifstream stampFile(stampPath);
+  std::stringstream spilledStamp;
+  spilledStamp << stampFile.rdbuf();
+  if (stampFile && spilledStamp.str() == stamp) {
+    return;
+  }
+
+  std::error_code error;
+  for (const auto &file : fs::directory_iterator(spillDir, error)) {
+    if (file.is_regular_file()) {
+      fs::remove(file.path(), error);
+    }
+  }
+
+  std::ofstream(stampPath) << stamp;
+}
+
+std::filesystem::path FrameCache::spillPathFor(const std::string &key) const {
+  char fileName[24];
+  snprintf(fileName, sizeof(fileName), "%016zx.frame",
+           std::hash<std::string>{}(key));
+
+  std::filesystem::path path(spillDir);
+  path.append(fileName);
+  return path;
+}
+
+// Null if the frame isn't in memory or the spill directory
+std::shared_ptr<std::vector<uchar>>
+FrameCache::getEncoded(const std::string &key) {
+  std::shared_ptr<std::vector<uchar>> encoded = cache.get(key);
+  if (encoded || spillDir.empty()) {
+    return encoded;
+  }
+
+  // The key the frame was spilled under, then the JPEG
+  std::vector<uchar> spilled = BulkReader::readFile(spillPathFor(key));
+  uint32_t keySize;
+  if (spilled.size() < sizeof(keySize)) {
+    return nullptr;
+  }
+  memcpy(&keySize, spilled.data(), sizeof(keySize));
+  size_t headerSize = sizeof(keySize) + keySize;
+  if (spilled.size() <= headerSize ||
+      key.compare(0, std::string::npos,
+                  (const char *)spilled.data() + sizeof(keySize),
+                  keySize) != 0) {
+    return nullptr;
+  }
+
+  spillHits++;
+  encoded = std::make_shared<std::vector<uchar>>(spilled.begin() + headerSize,
+                                                 spilled.end());
+  cache.put(key, encoded, encoded->size());
+  return encoded;
+}
+
+// Empty if the frame isn't cached
+cv::Mat FrameCache::get(const std::string &key) {
+  std::shared_ptr<std::vector<uchar>> encoded = getEncoded(key);
+  if (!encoded) {
+    return cv::Mat();
+  }
+
+  return cv::imdecode(*encoded, cv::IMREAD_COLOR);
+}
+
+// Returns the frame as it was encoded, for anything writing it out
+std::shared_ptr<std::vector<uchar>> FrameCache::put(const std::string &key,
+                                                    const cv::Mat &frame) {
+  auto encoded = std::make_shared<std::vector<uchar>>();
+  cv::imencode(".jpg", frame, *encoded,
+               {cv::IMWRITE_JPEG_QUALITY, FRAME_CACHE_JPEG_QUALITY});
+  cache.put(key, encoded, encoded->size());
+
+  if (!spillDir.empty()) {
+    // Written to a temporary file first so that a half written frame is never
+    // read back
+    std::filesystem::path spillPath = spillPathFor(key);
+    std::filesystem::path tmpPath = spillPath;
+    tmpPath += ".tmp" + std::to_string(
+        std::hash<std::thread::id>{}(std::this_thread::get_id()));
+
+    uint32_t keySize = key.size();
+    std::ofstream spillFile(tmpPath, std::ios::binary);
+    spillFile.write((const char *)&keySize, sizeof(keySize));
+    spillFile.write(key.data(), keySize);
+    spillFile.write((const char *)encoded->data(), encoded->size());
+    spillFile.close();
+
+    std::error_code error;
+    if (spillFile) {
+      std::filesystem::rename(tmpPath, spillPath, error);
+    } else {
+      std::filesystem::remove(tmpPath, error);
+    }
+  }
+
+  return encoded;
+}
+
+FrameCacheStats FrameCache::stats() const {
+  FrameCacheStats current;
+  static_cast<LruCacheStats &>(current) = cache.getStats();
+  current.spillHits = spillHits;
+  return current;
+}
+
+std::ostream &operator<<(std::ostream &os, const FrameCacheStats &stats) {
+  os << stats.entries << " frames, " << stats.hits << " hits, " << stats.misses
+     << " misses (" << stats.spillHits << " from disk), " << stats.evictions
+     << " evictions, " << stats.bytes / 1048576 << '/'
+     << stats.budget / 1048576 << "MB";
+  return os;
+}
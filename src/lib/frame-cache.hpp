@@ -0,0 +1,44 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+
+#include "../precompiled.h"
+#include "../config.h"
+
+#include "lru-cache.hpp"
+
+struct FrameCacheStats : LruCacheStats {
+  // Misses found in the spill directory instead of being rendered again
+  size_t spillHits = 0;
+};
+
+// Rendered frames, kept JPEG encoded: a frame is 4.5MB decoded but only a few
+// hundred KB encoded, so long collections fit in memory. Frames are decoded
+// again by whoever asks for them, on their own thread. With a spill directory,
+// frames are also written there, so that they can be read back once evicted
+// (or by a later run) instead of being rendered again. Each spilled frame
+// keeps its full key, so files whose names collide are never mixed up.
+class FrameCache {
+  LruCache<std::string, std::vector<uchar>> cache;
+  std::string spillDir;
+  std::atomic_size_t spillHits;
+
+  std::filesystem::path spillPathFor(const std::string &key) const;
+
+public:
+  FrameCache(size_t budget, const std::string &spillDir = "");
+
+  static FrameCache &shared();
+
+  void validateSpill(const std::string &stamp);
+
+  std::shared_ptr<std::vector<uchar>> getEncoded(const std::string &key);
+  cv::Mat get(const std::string &key);
+  std::shared_ptr<std::vector<uchar>> put(const std::string &key,
+                                          const cv::Mat &frame);
+
+  FrameCacheStats stats() const;
+};
+
+std::ostream &operator<<(std::ostream &os, const FrameCacheStats &stats);
@@ -1,11 +1,52 @@
+#include <condition_variable>
+#include <set>
+
 #include "frame-collection.hpp"
 
+// Reads whichever of the binary and text frame data was saved last
 FrameCollection::FrameCollection(const std::string &name) {
   namespace fs = std::filesystem;
 
-  std::filesystem::path storePath("assets/collections");
-  storePath.append(name);
-  storePath.append(".frame-data");
+  fs::path dirPath("assets/collections");
+  dirPath.append(name);
+  fs::path textPath = dirPath / ".frame-data";
+  fs::path binaryPath = dirPath / ".frames";
+
+  std::error_code textError, binaryError;
+  fs::file_time_type textTime = fs::last_write_time(textPath, textError);
+  fs::file_time_type binaryTime = fs::last_write_time(binaryPath, binaryError);
+
+  fs::path readPath;
+  if (!binaryError && (textError || binaryTime >= textTime)) {
+    readPath = binaryPath;
+    readBinary(binaryPath);
+  } else {
+    readPath = textPath;
+    readText(textPath);
+  }
+
+  // Frames spilled by an earlier run are only reused if neither these frames
+  // nor the stores of the images in them have changed since
+  std::set<fs::path> storePaths;
+  for (const FrameData &frameData : *this) {
+    for (const MatchData &match : frameData.frames) {
+      storePaths.insert(fs::path(match.path()).parent_path() / ".store");
+    }
+  }
+
+  std::stringstream stamp;
+  stamp << readPath.string() << ','
+        << fs::last_write_time(readPath).time_since_epoch().count() << '\n';
+  for (const fs::path &storePath : storePaths) {
+    std::error_code error;
+    stamp << storePath.string() << ','
+          << fs::last_write_time(storePath, error).time_since_epoch().count()
+          << '\n';
+  }
+  FrameCache::shared().validateSpill(stamp.str());
+}
+
+void FrameCollection::readText(const std::filesystem::path &storePath) {
   std::ifstream storeFile(storePath);
 
   if (!storeFile) {
@@ -36,7 +77,7 @@ FrameCollection::FrameCollection(const std::string &name) {
         std::getline(matchStream, substr, ',');
 
         if (i == 0) {
-          matchData.path = substr;
+          matchData.image = PathTable::shared().intern(substr);
         } else if (i == 1) {
           matchData.percentage = std::stof(substr);
         } else if (i == 2) {
@@ -45,6 +86,10 @@ FrameCollection::FrameCollection(const std::string &name) {
           matchData.originX = std::stoi(substr);
         } else if (i == 4) {
           matchData.originY = std::stoi(substr);
+        } else if (i == 5) {
+          matchData.orientation = std::stoi(substr);
+        } else if (i == 6) {
+          matchData.angle = std::stof(substr);
         }
 
         i++;
@@ -55,31 +100,158 @@ FrameCollection::FrameCollection(const std::string &name) {
 
     push_back(std::move(frameData));
   }
+}
 
-  _cachedMatches.resize(size());
-  _isCachedMatches.resize(size());
-  std::fill(_isCachedMatches.begin(), _isCachedMatches.end(), false);
+// The binary format is "ASFRAME3", then the paths used (a uint32 count, then
+// each as a uint32 length and its bytes), then the frames (a uint32 count,
+// then each as a uint32 count of matches). Each match is a uint32 index into
+// the paths, the percentage and scale as floats, the origin as int32s, the
+// orientation as a uint8 and the angle as a float. "ASFRAME2" files are the
+// same without angles, and "ASFRAME1" files without orientations either
+void FrameCollection::readBinary(const std::filesystem::path &storePath) {
+  std::ifstream storeFile(storePath, std::ios::binary);
+  if (!storeFile) {
+    throw std::runtime_error("Failed to open store file.");
+  }
+
+  auto readValue = [&](auto &value) {
+    if (!storeFile.read((char *)&value, sizeof(value))) {
+      throw std::runtime_error("Frame data file is truncated.");
+    }
+  };
+
+  char magic[8];
+  if (!storeFile.read(magic, sizeof(magic))) {
+    throw std::runtime_error("Frame data file is invalid.");
+  }
+  std::string magicString(magic, sizeof(magic));
+  if (magicString != "ASFRAME1" && magicString != "ASFRAME2" &&
+      magicString != "ASFRAME3") {
+    throw std::runtime_error("Frame data file is invalid.");
+  }
+  int version = magic[7] - '0';
+
+  uint32_t pathCount;
+  readValue(pathCount);
+  std::vector<int> images(pathCount);
+  for (uint32_t i = 0; i < pathCount; ++i) {
+    uint32_t length;
+    readValue(length);
+    std::string path(length, '\0');
+    if (!storeFile.read(path.data(), length)) {
+      throw std::runtime_error("Frame data file is truncated.");
+    }
+    images[i] = PathTable::shared().intern(path);
+  }
+
+  uint32_t frameCount;
+  readValue(frameCount);
+  reserve(frameCount);
+  for (uint32_t i = 0; i < frameCount; ++i) {
+    uint32_t matchCount;
+    readValue(matchCount);
+
+    FrameData frameData;
+    frameData.frames.resize(matchCount);
+    for (MatchData &matchData : frameData.frames) {
+      uint32_t pathIndex;
+      int32_t originX, originY;
+      readValue(pathIndex);
+      readValue(matchData.percentage);
+      readValue(matchData.scale);
+      readValue(originX);
+      readValue(originY);
+      if (version >= 2) {
+        uint8_t orientation;
+        readValue(orientation);
+        matchData.orientation = orientation;
+      }
+      if (version >= 3) {
+        readValue(matchData.angle);
+      }
+
+      matchData.image = images.at(pathIndex);
+      matchData.originX = originX;
+      matchData.originY = originY;
+    }
+
+    push_back(std::move(frameData));
+  }
+}
+
+void FrameCollection::writeBinary(const std::filesystem::path &storePath) const {
+  std::ofstream storeFile(storePath, std::ios::binary);
+  if (!storeFile) {
+    throw std::runtime_error("Failed to open store file.");
+  }
+
+  auto writeValue = [&](auto value) {
+    storeFile.write((const char *)&value, sizeof(value));
+  };
+
+  // Numbered in the order they're first used
+  std::unordered_map<int, uint32_t> pathIndexes;
+  std::vector<int> images;
+  for (const FrameData &frameData : *this) {
+    for (const MatchData &matchData : frameData.frames) {
+      if (pathIndexes.emplace(matchData.image, images.size()).second) {
+        images.push_back(matchData.image);
+      }
+    }
+  }
 
-  _cachedImages.resize(size());
-  _isCachedImages.resize(size());
-  std::fill(_isCachedImages.begin(), _isCachedImages.end(), false);
+  storeFile.write("ASFRAME3", 8);
+  writeValue((uint32_t)images.size());
+  for (int image : images) {
+    const std::string &path = PathTable::shared().path(image);
+    writeValue((uint32_t)path.size());
+    storeFile.write(path.data(), path.size());
+  }
+
+  writeValue((uint32_t)size());
+  for (const FrameData &frameData : *this) {
+    writeValue((uint32_t)frameData.frames.size());
+    for (const MatchData &matchData : frameData.frames) {
+      writeValue(pathIndexes[matchData.image]);
+      writeValue(matchData.percentage);
+      writeValue(matchData.scale);
+      writeValue((int32_t)matchData.originX);
+      writeValue((int32_t)matchData.originY);
+      writeValue((uint8_t)matchData.orientation);
+      writeValue(matchData.angle);
+    }
+  }
+
+  if (!storeFile) {
+    throw std::runtime_error("Failed to write store file.");
+  }
 }
 
+// Only the best FRAME_CANDIDATES images are kept as candidates for the frame
 void FrameCollection::addFrame(ImageList imageList) {
   FrameData frameData;
 
   imageList.sortBy("match-percentage");
 
   for (std::shared_ptr<EdgedImage> &image : imageList) {
+    if (frameData.frames.size() >= FRAME_CANDIDATES) {
+      break;
+    }
+
     frameData.frames.emplace_back(
         image->path, image->lastMatch.percentage, image->lastMatch.scale,
-        image->lastMatch.originX, image->lastMatch.originY);
+        image->lastMatch.originX, image->lastMatch.originY,
+        image->lastMatch.orientation, image->lastMatch.angle);
   }
 
   push_back(std::move(frameData));
+  _solver.reset();
 }
 
-void FrameCollection::popFrame() { pop_back(); }
+void FrameCollection::popFrame() {
+  pop_back();
+  _solver.reset();
+}
 
 void FrameCollection::save(const std::string &name) {
   namespace fs = std::filesystem;
@@ -94,6 +266,11 @@ void FrameCollection::save(const std::string &name) {
 
   fs::create_directory(storePath);
 
+  if (FRAME_DATA_BINARY) {
+    writeBinary(storePath / ".frames");
+    return;
+  }
+
   storePath.append(".frame-data");
 
   std::ofstream storeFile(storePath);
@@ -104,111 +281,286 @@ void FrameCollection::save(const std::string &name) {
   storeFile << *this;
 }
 
-// Currently this function uses greedy matching to grab the first match
-// containing an image that hasn't already been used. In the future it would
-// be great if it implemented the hungarian algorithm for better matching.
+// Images are assigned to every frame at once, the first time any frame's
+// match is needed. After that, edits only change the frames they have to
 std::vector<MatchData>::iterator FrameCollection::matchAt(int pos) {
-  if (_isCachedMatches.at(pos)) {
-    return _cachedMatches.at(pos);
+  if (!_solver) {
+    assignMatches();
   }
 
-  std::vector<MatchData>::iterator proposedMatch = at(pos).frames.begin();
-  for (; proposedMatch < at(pos).frames.end(); ++proposedMatch) {
-    bool alreadyUsed = false;
-    for (int i = 0; i < pos; ++i) {
-      if (matchAt(i)->path == proposedMatch->path) {
-        alreadyUsed = true;
-        break;
-      }
-    }
+  return _cachedMatches.at(pos);
+}
 
-    if (!alreadyUsed) {
-      break;
+std::vector<AssignmentCandidate>
+FrameCollection::assignmentCandidates(int pos) const {
+  std::vector<AssignmentCandidate> candidates;
+  for (const MatchData &match : at(pos).frames) {
+    candidates.push_back({match.image, match.percentage});
+  }
+  return candidates;
+}
+
+std::vector<std::vector<AssignmentCandidate>>
+FrameCollection::assignmentCandidates() const {
+  std::vector<std::vector<AssignmentCandidate>> candidates;
+  for (int pos = 0; pos < size(); ++pos) {
+    candidates.push_back(assignmentCandidates(pos));
+  }
+  return candidates;
+}
+
+// A frame whose candidates are all needed elsewhere falls back to its best
+// match, which means the image is used twice
+static std::vector<MatchData>::iterator chosenMatch(FrameData &frameData,
+                                                    int chosen) {
+  return frameData.frames.begin() + std::max(chosen, 0);
+}
+
+// Maximises the total match percentage with each image used at most once
+void FrameCollection::assignMatches() {
+  auto start = std::chrono::high_resolution_clock::now();
+
+  _solver = std::make_unique<AssignmentSolver>(assignmentCandidates());
+  _assignment = _solver->assignment();
+
+  std::chrono::duration<float> duration =
+      std::chrono::high_resolution_clock::now() - start;
+  _assignment.seconds = duration.count();
+
+  _cachedMatches.resize(size());
+  for (int pos = 0; pos < size(); ++pos) {
+    _cachedMatches[pos] = chosenMatch(at(pos), _solver->chosen(pos));
+  }
+}
+
+static bool sameFrame(const MatchData &a, const MatchData &b) {
+  return a.image == b.image && a.scale == b.scale && a.originX == b.originX &&
+         a.originY == b.originY && a.orientation == b.orientation &&
+         a.angle == b.angle;
+}
+
+// For after the candidates of the frames in `edited` have changed, which maps
+// each of them to its match from before. Only frames that might now have a
+// different image are assigned again. Returns the frames whose match changed
+std::vector<int>
+FrameCollection::updateAssignment(const std::map<int, MatchData> &edited) {
+  for (auto &[pos, previous] : edited) {
+    _solver->setCandidates(pos, assignmentCandidates(pos));
+  }
+
+  std::vector<int> moved = _solver->solve();
+  _assignment = _solver->assignment();
+
+  std::set<int> affected(moved.begin(), moved.end());
+  for (auto &[pos, previous] : edited) {
+    affected.insert(pos);
+  }
+
+  std::vector<int> changed;
+  for (int pos : affected) {
+    auto it = edited.find(pos);
+    // Frames that weren't edited still have their old match to compare with
+    MatchData previous = it != edited.end() ? it->second : *_cachedMatches[pos];
+
+    _cachedMatches[pos] = chosenMatch(at(pos), _solver->chosen(pos));
+    if (at(pos).frames.empty() || !sameFrame(previous, *_cachedMatches[pos])) {
+      changed.push_back(pos);
     }
   }
 
-  _cachedMatches.at(pos) = proposedMatch;
-  _isCachedMatches.at(pos) = true;
+  return changed;
+}
 
-  return proposedMatch;
+const Assignment &FrameCollection::assignment() {
+  if (!empty()) {
+    matchAt(0);
+  }
+  return _assignment;
+}
+
+// How the old first come, first served assignment would have done, to
+// compare against
+Assignment FrameCollection::greedyAssignment() const {
+  return assignGreedy(assignmentCandidates());
 }
 
 std::vector<MatchData>* FrameCollection::matchesAt(int pos) {
   return &at(pos).frames;
 }
 
-cv::Mat FrameCollection::imageAt(int pos) {
-  if (_isCachedImages.at(pos)) {
-    return _cachedImages.at(pos);
+cv::Mat FrameCollection::imageAt(int pos) { return imageFor(*matchAt(pos)); }
+
+cv::Mat FrameCollection::imageFor(std::vector<MatchData>::iterator match) {
+  return imageFor(*match);
+}
+
+cv::Mat FrameCollection::imageFor(std::vector<MatchData>::iterator match,
+                                  const std::vector<uchar> &encoded) {
+  return imageFor(*match, encoded);
+}
+
+// Frames come from the shared frame cache, so edited matches get new frames
+// without anything being thrown away. Safe to call from any thread
+cv::Mat FrameCollection::imageFor(const MatchData &match) const {
+  std::string key = frameKeyFor(match);
+  cv::Mat cached = FrameCache::shared().get(key);
+  if (!cached.empty()) {
+    return cached;
   }
 
-  std::vector<MatchData>::iterator match = matchAt(pos);
-  cv::Mat image = imageFor(match);
+  cv::Mat image = renderFrame(match);
+  FrameCache::shared().put(key, image);
+  return image;
+}
 
-  _cachedImages.at(pos) = image;
-  _isCachedImages.at(pos) = true;
+cv::Mat FrameCollection::imageFor(const MatchData &match,
+                                  const std::vector<uchar> &encoded) const {
+  std::string key = frameKeyFor(match);
+  cv::Mat cached = FrameCache::shared().get(key);
+  if (!cached.empty()) {
+    return cached;
+  }
 
+  cv::Mat image = renderFrame(match, encoded);
+  FrameCache::shared().put(key, image);
   return image;
 }
 
-// todo move caching to this?
-cv::Mat FrameCollection::imageFor(std::vector<MatchData>::iterator match) {
-  cv::Mat image = cv::imread(match->path);
+// Frames rendered from previews are kept apart from ones rendered from the
+// originals
+std::string FrameCollection::frameKeyFor(const MatchData &match) const {
+  std::stringstream key;
+  key << match.path() << ',' << match.scale << ',' << match.originX << ','
+      << match.originY << ',' << match.orientation << ',' << match.angle
+      << (_usePreviews ? ",preview" : "");
+  return key.str();
+}
+
+// Originals come from the shared image cache. If using previews, they're
+// only read for images that don't have one
+cv::Mat FrameCollection::renderFrame(const MatchData &match) const {
+  if (_usePreviews) {
+    cv::Mat preview = PreviewPack::loadPreview(match.path());
+    if (!preview.empty()) {
+      return cropFor(match, preview);
+    }
+  }
+
+  cv::Mat cached = ImageCache::shared().find(match.path());
+  if (!cached.empty()) {
+    return cropFor(match, cached);
+  }
+
+  return renderFrame(match, BulkReader::readFile(match.path()));
+}
 
+// Decodes only the part of the original that's needed where possible, which
+// doesn't go in the cache. Otherwise decodes the whole thing into the cache
+cv::Mat FrameCollection::renderFrame(const MatchData &match,
+                                     const std::vector<uchar> &encoded) const {
+  cv::Mat cached = ImageCache::shared().find(match.path());
+  if (!cached.empty()) {
+    return cropFor(match, cached);
+  }
+
+  ImageProbe probe = probeImage(encoded.data(), encoded.size());
+  if (probe.valid()) {
+    cv::Size outputSize = orientedSize(cv::Size(OUTPUT_WIDTH, OUTPUT_HEIGHT),
+                                       match.orientation);
+    cv::Mat region =
+        decodeJpegRoi(encoded, probe, roiFor(match, probe.width()),
+                      rotatedSize(outputSize, match.angle));
+
+    if (!region.empty()) {
+      return uprightFrame(match, region);
+    }
+  }
+
+  return cropFor(match, ImageCache::shared().get(match.path(), encoded));
+}
+
+// The part of an image imageWidth wide that a match covers, which is turned
+// with the match, or the bounding box of it if it's rotated
+cv::Rect FrameCollection::roiFor(const MatchData &match, int imageWidth) {
+  float realScale = (float)imageWidth / STORED_EDGES_WIDTH;
+  cv::Size canvasSize = rotatedSize(
+      orientedSize(cv::Size(CANVAS_WIDTH, CANVAS_HEIGHT), match.orientation),
+      match.angle);
+
+  cv::Rect roi;
+  roi.x = round(match.originX * realScale);
+  roi.y = round(match.originY * realScale);
+  roi.width = round(canvasSize.width * realScale * match.scale);
+  roi.height = round(canvasSize.height * realScale * match.scale);
+
+  return roi;
+}
+
+cv::Mat FrameCollection::cropFor(const MatchData &match,
+                                 const cv::Mat &image) {
   if (image.empty()) {
     throw std::runtime_error("Couldn't read source image");
   }
 
-  float realScale = (float)image.cols / STORED_EDGES_WIDTH;
+  return uprightFrame(match, image(roiFor(match, image.cols)));
+}
 
-  cv::Rect roi;
-  roi.x = round(match->originX * realScale);
-  roi.y = round(match->originY * realScale);
-  roi.width = round(CANVAS_WIDTH * realScale * match->scale);
-  roi.height = round(CANVAS_HEIGHT * realScale * match->scale);
+// Turns the part of the image a match covers back the way up the template
+// was, at the output size
+cv::Mat FrameCollection::uprightFrame(const MatchData &match,
+                                      const cv::Mat &region) {
+  cv::Mat unrotated = unrotateCrop(
+      region, match.angle,
+      orientedSize(cv::Size(CANVAS_WIDTH, CANVAS_HEIGHT), match.orientation));
 
-  cv::Mat cropped = image(roi);
-  cv::Mat scaledImage;
-  cv::resize(cropped, scaledImage, cv::Size(OUTPUT_WIDTH, OUTPUT_HEIGHT));
+  cv::Mat upright;
+  unorientImage(unrotated, upright, match.orientation);
 
+  cv::Mat scaledImage;
+  cv::resize(upright, scaledImage, cv::Size(OUTPUT_WIDTH, OUTPUT_HEIGHT));
   return scaledImage;
 }
 
-void FrameCollection::purgeCache() {
-  std::fill(_isCachedMatches.begin(), _isCachedMatches.end(), false);
-  std::fill(_isCachedImages.begin(), _isCachedImages.end(), false);
-}
+// Only the frames that had the image as a candidate are touched. Returns the
+// frames whose match changed
+std::vector<int> FrameCollection::forceMatch(
+    int pos, std::vector<MatchData>::iterator match) {
+  std::map<int, MatchData> edited;
+  edited[pos] = *matchAt(pos);
 
-void FrameCollection::forceMatch(int pos, std::vector<MatchData>::iterator match) {
   MatchData matchCopy = *match;
+  const std::vector<int> &rows = _solver->rowsWith(match->image);
+  for (int other : rows) {
+    edited.emplace(other, *matchAt(other));
+  }
+
   at(pos).frames.clear();
   at(pos).frames.push_back(matchCopy);
 
-  purgeCache();
-
-  match = at(pos).frames.begin();
-
   // Delete this image from all other frames
-  FrameData* current = &at(pos);
-  for (FrameData &otherFramesData : *this) {
-    if (&otherFramesData == current) {
+  for (auto &[other, previous] : edited) {
+    if (other == pos) {
       continue;
     }
 
-    std::vector<MatchData> &otherFrames = otherFramesData.frames;
-
-    auto otherPos = std::find_if(otherFrames.begin(), otherFrames.end(),
-        [&match](const MatchData &otherMatch) {
-      return match->path == otherMatch.path;
-    });
-
-    otherFrames.erase(otherPos);
+    std::vector<MatchData> &otherFrames = at(other).frames;
+    otherFrames.erase(std::remove_if(otherFrames.begin(), otherFrames.end(),
+        [&matchCopy](const MatchData &otherMatch) {
+      return matchCopy.image == otherMatch.image;
+    }), otherFrames.end());
   }
+
+  return updateAssignment(edited);
 }
 
-void FrameCollection::removeMatch(int pos, std::vector<MatchData>::iterator match) {
+std::vector<int> FrameCollection::removeMatch(
+    int pos, std::vector<MatchData>::iterator match) {
+  std::map<int, MatchData> edited;
+  edited[pos] = *matchAt(pos);
+
   at(pos).frames.erase(match);
-  purgeCache();
+
+  return updateAssignment(edited);
 }
 
 void FrameCollection::editMatchScale(int pos, float newScale) {
@@ -222,8 +574,6 @@ void FrameCollection::editMatchScale(int pos, float newScale) {
   match->originX = std::round((float)match->originX / newScale * oldScale);
   match->originY = std::round((float)match->originY / newScale * oldScale);
 
-  _isCachedImages.at(pos) = false;
-
   try {
     imageAt(pos);
   } catch(cv::Exception) {
@@ -236,8 +586,6 @@ void FrameCollection::editMatchOriginX(int pos, int originX) {
   MatchData matchBackup = *match;
 
   match->originX = originX;
-  _isCachedImages.at(pos) = false;
-
   try {
     imageAt(pos);
   } catch(cv::Exception) {
@@ -250,8 +598,6 @@ void FrameCollection::editMatchOriginY(int pos, int originY) {
   MatchData matchBackup = *match;
 
   match->originY = originY;
-  _isCachedImages.at(pos) = false;
-
   try {
     imageAt(pos);
   } catch(cv::Exception) {
@@ -259,29 +605,159 @@ void FrameCollection::editMatchOriginY(int pos, int originY) {
   }
 }
 
-void FrameCollection::preloadAll() {
+// Frames rendered from previews are fine for looking at, but anything being
+// written out should be rendered from the originals
+void FrameCollection::usePreviews(bool usePreviews) {
+  _usePreviews = usePreviews;
+}
+
+// Renders frames on a pool of threads, each writing out its own JPEGs. Frames
+// still in the frame cache are written as they were encoded there. For a
+// video, frames are also handed back to be added to it in order, with no more
+// than EXPORT_QUEUE_DEPTH of them waiting at once
+void FrameCollection::writeImages(const std::string &name, bool writeVideo) {
+  std::filesystem::path dirPath("assets/collections");
+  dirPath.append(name);
+
+  // Matches are worked out first as matchAt isn't thread safe
+  std::vector<MatchData> matches;
   for (int i = 0; i < size(); ++i) {
-    imageAt(i);
+    matches.push_back(*matchAt(i));
   }
-}
 
-void FrameCollection::writeImages(const std::string &name) {
-  for (size_t i = 0; i < size(); ++i) {
-    cv::Mat image = imageAt(i);
+  // Names are padded to at least three digits, and more if there are enough
+  // frames to need them, so that they still sort in order
+  int lastFrame = std::max((int)matches.size() - 1, 0);
+  int nameDigits = std::max(3, (int)std::to_string(lastFrame).size());
+
+  cv::VideoWriter videoWriter;
+  if (writeVideo) {
+    std::filesystem::path videoPath = dirPath;
+    videoPath.append("animation.avi");
+    videoWriter.open(videoPath.string(),
+                     cv::VideoWriter::fourcc('M', 'J', 'P', 'G'),
+                     EXPORT_VIDEO_FPS, cv::Size(OUTPUT_WIDTH, OUTPUT_HEIGHT));
+    if (!videoWriter.isOpened()) {
+      throw std::runtime_error("Failed to open video file.");
+    }
+  }
+
+  std::atomic_int frameIndex(0);
+  std::mutex writeMutex;
+  std::condition_variable writeCondition;
+  std::map<int, cv::Mat> completed;
+  int nextToWrite = 0;
+  bool stopping = false;
+  std::exception_ptr writeError;
+
+  auto threadFn = [&]() {
+    while (true) {
+      int i = frameIndex++;
+      if (i >= matches.size()) {
+        break;
+      }
+
+      try {
+        std::string key = frameKeyFor(matches[i]);
+        cv::Mat image;
+        std::shared_ptr<std::vector<uchar>> encoded =
+            FrameCache::shared().getEncoded(key);
+        if (!encoded) {
+          image = renderFrame(matches[i]);
+          encoded = FrameCache::shared().put(key, image);
+        }
+
+        char frameName[32];
+        snprintf(frameName, sizeof(frameName), "%0*d.jpg", nameDigits, i);
+        std::filesystem::path imagePath = dirPath;
+        imagePath.append(frameName);
 
-    char frameName[8];
-    sprintf(frameName, "%03d.jpg", (int)i);
-    std::filesystem::path imagePath("assets/collections");
-    imagePath.append(name);
-    imagePath.append(frameName);
+        std::ofstream imageFile(imagePath, std::ios::binary);
+        imageFile.write((const char *)encoded->data(), encoded->size());
+        if (!imageFile) {
+          throw std::runtime_error("Failed to write frame.");
+        }
+
+        if (writeVideo) {
+          if (image.empty()) {
+            image = cv::imdecode(*encoded, cv::IMREAD_COLOR);
+          }
+
+          std::unique_lock<std::mutex> lock(writeMutex);
+          writeCondition.wait(lock, [&]() {
+            return stopping || i < nextToWrite + EXPORT_QUEUE_DEPTH;
+          });
+          if (stopping) {
+            break;
+          }
+          completed.emplace(i, std::move(image));
+          writeCondition.notify_all();
+        }
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        writeError = std::current_exception();
+        stopping = true;
+        writeCondition.notify_all();
+        break;
+      }
+    }
+  };
+
+  int threads = std::max(1, (int)std::thread::hardware_concurrency());
+  std::vector<std::thread> threadVector;
+  threadVector.reserve(threads);
+  for (int i = 0; i < threads; ++i) {
+    threadVector.emplace_back(threadFn);
+  }
+
+  if (writeVideo) {
+    try {
+      std::unique_lock<std::mutex> lock(writeMutex);
+      while (nextToWrite < matches.size()) {
+        writeCondition.wait(lock, [&]() {
+          return stopping || completed.count(nextToWrite);
+        });
+        if (stopping) {
+          break;
+        }
+
+        cv::Mat image = std::move(completed[nextToWrite]);
+        completed.erase(nextToWrite);
+
+        lock.unlock();
+        videoWriter.write(image);
+        lock.lock();
+
+        nextToWrite++;
+        writeCondition.notify_all();
+      }
+    } catch (...) {
+      // The workers have to be stopped and joined before this goes any
+      // further, or destroying them while they're running terminates
+      std::lock_guard<std::mutex> lock(writeMutex);
+      if (!writeError) {
+        writeError = std::current_exception();
+      }
+      stopping = true;
+      writeCondition.notify_all();
+    }
+  }
+
+  for (std::thread &t : threadVector) {
+    if (t.joinable()) {
+      t.join();
+    }
+  }
 
-    cv::imwrite(imagePath.string(), image);
+  if (writeError) {
+    std::rethrow_exception(writeError);
   }
 }
 
 std::ostream &operator<<(std::ostream &os, const MatchData &matchData) {
-  os << matchData.path << ',' << matchData.percentage << ',' << matchData.scale
-     << ',' << matchData.originX << ',' << matchData.originY;
+  os << matchData.path() << ',' << matchData.percentage << ',' << matchData.scale
+     << ',' << matchData.originX << ',' << matchData.originY << ','
+     << matchData.orientation << ',' << matchData.angle;
   return os;
 }
 
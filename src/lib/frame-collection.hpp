@@ -2,21 +2,39 @@
 
 #include <filesystem>
 #include <fstream>
+#include <map>
 
 #include "../precompiled.h"
 
+#include "bulk-reader.hpp"
+#include "decode-roi.hpp"
+#include "frame-assignment.hpp"
+#include "frame-cache.hpp"
+#include "image-cache.hpp"
+#include "preview-pack.hpp"
 #include "image-list.hpp"
+#include "match-orientation.hpp"
+#include "path-table.hpp"
 
+// Images are referred to by their ID in the shared path table
 struct MatchData {
-  std::string path;
+  int image;
   float percentage, scale;
   int originX, originY;
+  int orientation;
+  float angle;
 
-  MatchData() {}
-  MatchData(std::string &path, float percentage, float scale, int originX,
-            int originY)
-      : path(path), percentage(percentage), scale(scale), originX(originX),
-        originY(originY) {}
+  MatchData()
+      : image(-1), percentage(0), scale(1), originX(0), originY(0),
+        orientation(MatchOrientation_Upright), angle(0) {}
+  MatchData(const std::string &path, float percentage, float scale,
+            int originX, int originY,
+            int orientation = MatchOrientation_Upright, float angle = 0)
+      : image(PathTable::shared().intern(path)), percentage(percentage),
+        scale(scale), originX(originX), originY(originY),
+        orientation(orientation), angle(angle) {}
+
+  const std::string &path() const { return PathTable::shared().path(image); }
 };
 
 // todo refactor this
@@ -25,14 +43,27 @@ struct FrameData {
 };
 
 class FrameCollection : public std::vector<FrameData> {
-  std::vector<bool> _isCachedMatches;
   std::vector<std::vector<MatchData>::iterator> _cachedMatches;
-  std::vector<bool> _isCachedImages;
-  std::vector<cv::Mat> _cachedImages;
+  std::unique_ptr<AssignmentSolver> _solver;
+  Assignment _assignment;
 
   std::vector<MatchData>::iterator _uncached;
+  bool _usePreviews = false;
 
-  void purgeCache();
+  void readText(const std::filesystem::path &storePath);
+  void readBinary(const std::filesystem::path &storePath);
+  void writeBinary(const std::filesystem::path &storePath) const;
+  void assignMatches();
+  std::vector<int> updateAssignment(const std::map<int, MatchData> &edited);
+  std::vector<AssignmentCandidate> assignmentCandidates(int pos) const;
+  std::vector<std::vector<AssignmentCandidate>> assignmentCandidates() const;
+  static cv::Mat cropFor(const MatchData &match, const cv::Mat &image);
+  static cv::Mat uprightFrame(const MatchData &match, const cv::Mat &region);
+  static cv::Rect roiFor(const MatchData &match, int imageWidth);
+  std::string frameKeyFor(const MatchData &match) const;
+  cv::Mat renderFrame(const MatchData &match) const;
+  cv::Mat renderFrame(const MatchData &match,
+                      const std::vector<uchar> &encoded) const;
 
 public:
   FrameCollection() {};
@@ -43,16 +74,23 @@ public:
 
   std::vector<MatchData>::iterator matchAt(int pos);
   std::vector<MatchData>* matchesAt(int pos);
+  const Assignment &assignment();
+  Assignment greedyAssignment() const;
   cv::Mat imageAt(int pos);
   cv::Mat imageFor(std::vector<MatchData>::iterator match);
-  void forceMatch(int pos, std::vector<MatchData>::iterator match);
-  void removeMatch(int pos, std::vector<MatchData>::iterator match);
+  cv::Mat imageFor(std::vector<MatchData>::iterator match,
+                   const std::vector<uchar> &encoded);
+  cv::Mat imageFor(const MatchData &match) const;
+  cv::Mat imageFor(const MatchData &match,
+                   const std::vector<uchar> &encoded) const;
+  std::vector<int> forceMatch(int pos, std::vector<MatchData>::iterator match);
+  std::vector<int> removeMatch(int pos, std::vector<MatchData>::iterator match);
   void editMatchScale(int pos, float newScale);
   void editMatchOriginX(int pos, int originX);
   void editMatchOriginY(int pos, int originY);
 
-  void preloadAll();
-  void writeImages(const std::string &name);
+  void usePreviews(bool usePreviews);
+  void writeImages(const std::string &name, bool writeVideo = false);
 
   friend std::ostream& operator<<(std::ostream& os, const FrameCollection& frames);
 };
@@ -0,0 +1,161 @@
+#include "frame-prefetcher.hpp"
+
+FramePrefetcher::FramePrefetcher(FrameCollection &frames, int ahead,
+                                 int behind)
+    : frames(frames), ahead(ahead), behind(behind) {
+  int threads = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+  workers.reserve(threads);
+  for (int i = 0; i < threads; ++i) {
+    workers.emplace_back(&FramePrefetcher::workerFn, this);
+  }
+}
+
+FramePrefetcher::~FramePrefetcher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wakeWorkers.notify_all();
+
+  for (std::thread &t : workers) {
+    if (t.joinable()) {
+      t.join();
+    }
+  }
+}
+
+void FramePrefetcher::workerFn() {
+  while (true) {
+    std::unique_lock<std::mutex> lock(mutex);
+    wakeWorkers.wait(lock, [&]() { return stopping || !queue.empty(); });
+    if (stopping) {
+      return;
+    }
+
+    auto [frameId, match] = queue.front();
+    queue.pop_front();
+    int renderGeneration = generations[frameId];
+    inFlight.insert({frameId, renderGeneration});
+    lock.unlock();
+
+    cv::Mat image;
+    try {
+      image = frames.imageFor(match);
+    } catch (const std::exception &e) {
+      // Show something rather than waiting for it forever
+      std::cerr << "Couldn't render frame " << frameId << ": " << e.what()
+                << '\n';
+      image = cv::Mat::zeros(OUTPUT_HEIGHT, OUTPUT_WIDTH, CV_8UC3);
+    }
+
+    lock.lock();
+    inFlight.erase({frameId, renderGeneration});
+    if (renderGeneration == generations[frameId]) {
+      rendered[frameId] = image;
+    }
+    lock.unlock();
+
+    frameReady.notify_all();
+  }
+}
+
+// Queues the frames around frameId that aren't rendered yet: the current one
+// first, then the ones ahead in the direction of playback, then a few behind.
+// Playback loops, so the window wraps around. Anything outside the window is
+// dropped
+void FramePrefetcher::seek(int frameId, int direction) {
+  int count = frames.size();
+  if (count == 0) {
+    return;
+  }
+
+  auto frameAt = [&](int offset) {
+    return ((frameId + offset) % count + count) % count;
+  };
+
+  std::vector<int> wanted = {frameId};
+  for (int i = 1; i <= ahead; ++i) {
+    wanted.push_back(frameAt(i * direction));
+  }
+  for (int i = 1; i <= behind; ++i) {
+    wanted.push_back(frameAt(-i * direction));
+  }
+
+  std::set<int> wantedSet;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.clear();
+
+    for (int id : wanted) {
+      if (!wantedSet.insert(id).second) {
+        continue;
+      }
+
+      if (!rendered.count(id) && !inFlight.count({id, generations[id]})) {
+        queue.emplace_back(id, *frames.matchAt(id));
+      }
+    }
+
+    for (auto it = rendered.begin(); it != rendered.end();) {
+      it = wantedSet.count(it->first) ? std::next(it) : rendered.erase(it);
+    }
+  }
+
+  wakeWorkers.notify_all();
+}
+
+bool FramePrefetcher::ready(int frameId) {
+  std::lock_guard<std::mutex> lock(mutex);
+  return rendered.count(frameId);
+}
+
+// Waits for the frame if it isn't rendered yet
+cv::Mat FramePrefetcher::get(int frameId) {
+  std::unique_lock<std::mutex> lock(mutex);
+
+  bool queued = std::any_of(queue.begin(), queue.end(), [&](auto &item) {
+    return item.first == frameId;
+  });
+  if (!rendered.count(frameId) && !queued &&
+      !inFlight.count({frameId, generations[frameId]})) {
+    queue.emplace_front(frameId, *frames.matchAt(frameId));
+    wakeWorkers.notify_one();
+  }
+
+  frameReady.wait(lock, [&]() { return rendered.count(frameId) > 0; });
+  return rendered[frameId];
+}
+
+// For when matches have changed, so frames need rendering again
+void FramePrefetcher::invalidate() {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto &[frameId, renderGeneration] : inFlight) {
+    generations[frameId]++;
+  }
+  rendered.clear();
+  queue.clear();
+}
+
+// Only the given frames. Call seek afterwards to queue them again
+void FramePrefetcher::invalidate(const std::vector<int> &frameIds) {
+  if (frameIds.empty()) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  for (int frameId : frameIds) {
+    generations[frameId]++;
+    rendered.erase(frameId);
+  }
+
+  std::set<int> invalidated(frameIds.begin(), frameIds.end());
+  queue.erase(std::remove_if(queue.begin(), queue.end(), [&](auto &item) {
+    return invalidated.count(item.first) > 0;
+  }), queue.end());
+}
+
+int FramePrefetcher::readyCount() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return rendered.size();
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
+
+#include "../precompiled.h"
+#include "../config.h"
+
+#include "frame-collection.hpp"
+
+// Renders frames on a pool of background threads, starting with the ones
+// playback is heading towards, so that `build` can open its window straight
+// away instead of rendering every frame first. Only a window of frames around
+// the current one is kept.
+//
+// Everything other than the workers happens on the thread that owns the
+// FrameCollection, as FrameCollection itself isn't thread safe.
+class FramePrefetcher {
+  FrameCollection &frames;
+  int ahead, behind;
+
+  std::mutex mutex;
+  std::condition_variable wakeWorkers;
+  std::condition_variable frameReady;
+
+  std::map<int, cv::Mat> rendered;
+  std::deque<std::pair<int, MatchData>> queue;
+  // Frame ID and generation of frames being rendered
+  std::set<std::pair<int, int>> inFlight;
+  // Bumped when a frame is invalidated, so that renders started before then
+  // are thrown away
+  std::unordered_map<int, int> generations;
+  bool stopping = false;
+
+  std::vector<std::thread> workers;
+
+  void workerFn();
+
+public:
+  FramePrefetcher(FrameCollection &frames, int ahead = BUILD_PREFETCH_AHEAD,
+                  int behind = BUILD_PREFETCH_BEHIND);
+  ~FramePrefetcher();
+
+  void seek(int frameId, int direction = 1);
+  bool ready(int frameId);
+  cv::Mat get(int frameId);
+  void invalidate();
+  void invalidate(const std::vector<int> &frameIds);
+  int readyCount();
+};
@@ -0,0 +1,98 @@
+#include "image-cache.hpp"
+#include "bulk-reader.hpp"
+
+ImageCache::ImageCache(size_t budget) : cache(budget), sharedLoads(0) {}
+
+ImageCache &ImageCache::shared() {
+  static ImageCache imageCache((size_t)IMAGE_CACHE_MB * 1048576);
+  return imageCache;
+}
+
+cv::Mat ImageCache::get(const std::string &path) {
+  return get(path, [&]() {
+    std::vector<uchar> encoded = BulkReader::readFile(path);
+    return encoded.empty() ? cv::Mat() : cv::imdecode(encoded, cv::IMREAD_COLOR);
+  });
+}
+
+// For when the file has already been read, e.g. by a BulkReader
+cv::Mat ImageCache::get(const std::string &path,
+                        const std::vector<uchar> &encoded) {
+  return get(path, [&]() {
+    return encoded.empty() ? cv::Mat() : cv::imdecode(encoded, cv::IMREAD_COLOR);
+  });
+}
+
+// Loads with decodeFn on a miss, for anything that isn't just an image file.
+// Returns an empty Mat if the image can't be read. Failures aren't cached, so
+// they'll be tried again next time
+cv::Mat ImageCache::get(const std::string &key,
+                        const std::function<cv::Mat()> &decodeFn) {
+  std::shared_ptr<cv::Mat> cached = cache.get(key);
+  if (cached) {
+    return *cached;
+  }
+
+  std::promise<std::shared_ptr<cv::Mat>> loadPromise;
+  {
+    std::unique_lock<std::mutex> loadingLock(loadingMutex);
+
+    // Might have finished loading while we were waiting for the lock
+    cached = cache.peek(key);
+    if (cached) {
+      return *cached;
+    }
+
+    auto it = loading.find(key);
+    if (it != loading.end()) {
+      pending_load pending = it->second;
+      loadingLock.unlock();
+
+      sharedLoads++;
+      return *pending.get();
+    }
+
+    loading[key] = loadPromise.get_future().share();
+  }
+
+  std::shared_ptr<cv::Mat> image;
+  try {
+    image = std::make_shared<cv::Mat>(decodeFn());
+  } catch (...) {
+    std::lock_guard<std::mutex> loadingLock(loadingMutex);
+    loadPromise.set_exception(std::current_exception());
+    loading.erase(key);
+    throw;
+  }
+
+  std::lock_guard<std::mutex> loadingLock(loadingMutex);
+  if (!image->empty()) {
+    cache.put(key, image, image->total() * image->elemSize());
+  }
+  loadPromise.set_value(image);
+  loading.erase(key);
+
+  return *image;
+}
+
+// Only if it's already cached: doesn't load anything
+cv::Mat ImageCache::find(const std::string &key) {
+  std::shared_ptr<cv::Mat> cached = cache.get(key);
+  return cached ? *cached : cv::Mat();
+}
+
+void ImageCache::erase(const std::string &path) { cache.erase(path); }
+
+ImageCacheStats ImageCache::stats() const {
+  ImageCacheStats current;
+  static_cast<LruCacheStats &>(current) = cache.getStats();
+  current.sharedLoads = sharedLoads;
+  return current;
+}
+
+std::ostream &operator<<(std::ostream &os, const ImageCacheStats &stats) {
+  os << stats.hits << " hits, " << stats.misses << " misses ("
+     << stats.sharedLoads << " shared), " << stats.evictions << " evictions, "
+     << stats.bytes / 1048576 << '/' << stats.budget / 1048576 << "MB";
+  return os;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <future>
+#include <unordered_map>
+
+#include "../precompiled.h"
+#include "../config.h"
+
+#include "lru-cache.hpp"
+
+struct ImageCacheStats : LruCacheStats {
+  // Misses that waited for another thread already loading the same image
+  size_t sharedLoads = 0;
+};
+
+// Decoded originals, shared by everything in the process and limited to a
+// byte budget. Only one thread loads any given image at a time: others asking
+// for it wait for that load rather than decoding it again. The images handed
+// out share their pixels with the cache, so mustn't be drawn on.
+class ImageCache {
+  typedef std::shared_future<std::shared_ptr<cv::Mat>> pending_load;
+
+  LruCache<std::string, cv::Mat> cache;
+  std::mutex loadingMutex;
+  std::unordered_map<std::string, pending_load> loading;
+  std::atomic_size_t sharedLoads;
+
+public:
+  ImageCache(size_t budget);
+
+  static ImageCache &shared();
+
+  cv::Mat get(const std::string &path);
+  cv::Mat get(const std::string &path, const std::vector<uchar> &encoded);
+  cv::Mat get(const std::string &key,
+              const std::function<cv::Mat()> &decodeFn);
+  cv::Mat find(const std::string &key);
+  void erase(const std::string &path);
+
+  ImageCacheStats stats() const;
+};
+
+std::ostream &operator<<(std::ostream &os, const ImageCacheStats &stats);
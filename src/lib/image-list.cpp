@@ -1,36 +1,223 @@
 #include "image-list.hpp"
 #include "bitset-serialise.hpp"
 
-ImageList::ImageList(std::string dirPath) : dirPath(dirPath) {
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Used to work out which mount an image belongs to, regardless of how the
+// path was written
+static std::string mountKey(const std::filesystem::path &dirPath) {
+  std::filesystem::path normal = dirPath.lexically_normal();
+  if (!normal.has_filename() && normal.has_parent_path()) {
+    normal = normal.parent_path();
+  }
+  return normal;
+}
+
+// Whether a new image still needs a preview made
+static bool wantsPreview(const std::filesystem::path &path) {
+  return PREVIEWS_ENABLED &&
+         !PreviewPack::forDirectory(path.parent_path())->has(path.filename());
+}
+
+// Edge detection only needs a small decode, so by default a preview gets a
+// second, bigger one from the same buffer (see makePreview). With
+// PREVIEWS_SHARED_DECODE, one decode big enough for the preview does both
+static int detectionWidth(bool preview) {
+  return preview && PREVIEWS_SHARED_DECODE ? PREVIEW_WIDTH
+                                           : EDGE_DETECTION_WIDTH;
+}
+
+// How many megapixels decoding at minWidth comes to. Only JPEGs are reduced
+static double decodedMegapixels(const ImageProbe &probe, int minWidth,
+                                int *reduction) {
+  *reduction = 1;
+  if (probe.format == ImageFormat_Jpeg) {
+    reducedReadFlag(probe.width(), minWidth, reduction);
+  }
+  return probe.storedWidth * probe.storedHeight / 1e6 /
+         (*reduction * *reduction);
+}
+
+// Everything ingesting a new image decodes, to estimate the work up front
+static double ingestMegapixels(const std::filesystem::path &path,
+                               const ImageProbe &probe) {
+  bool preview = wantsPreview(path);
+  int reduction;
+  double megapixels =
+      decodedMegapixels(probe, detectionWidth(preview), &reduction);
+  if (preview && reduction != 1 && !PREVIEWS_SHARED_DECODE) {
+    megapixels += decodedMegapixels(probe, PREVIEW_WIDTH, &reduction);
+  }
+  return megapixels;
+}
+
+// The decode used for edge detection is reused if it wasn't reduced, as it's
+// as big as the image gets
+static void makePreview(const std::filesystem::path &path,
+                        const ImageProbe &probe,
+                        const std::vector<uchar> &buffer,
+                        const ReducedImage &source) {
+  if (source.reduction == 1 || PREVIEWS_SHARED_DECODE) {
+    PreviewPack::savePreview(path, source.image);
+    return;
+  }
+
+  ReducedImage preview = decodeImageReduced(buffer, probe, PREVIEW_WIDTH);
+  if (!preview.image.empty()) {
+    PreviewPack::savePreview(path, preview.image);
+  }
+}
+
+ImageList::ImageList(std::string dirPath, bool recursive, bool mapEdges)
+    : ImageList(std::vector<std::string>{dirPath}, recursive, mapEdges) {}
+
+// Each directory is mounted with its own store. If recursive, every
+// subdirectory is mounted too. Mounts are sorted so that the images - and so
+// their IDs - always come out in the same order
+ImageList::ImageList(const std::vector<std::string> &dirPaths, bool recursive,
+                     bool mapEdges)
+    : mapEdges(mapEdges) {
   namespace fs = std::filesystem;
 
-  if (!fs::exists(dirPath)) {
-    throw std::runtime_error("Directory doesn't exist: " + dirPath);
+  std::vector<std::string> mountPaths;
+
+  for (const std::string &dirPath : dirPaths) {
+    if (!fs::is_directory(dirPath)) {
+      throw std::runtime_error("Directory doesn't exist: " + dirPath);
+    }
+
+    mountPaths.push_back(dirPath);
+
+    if (!recursive) {
+      continue;
+    }
+
+    for (auto it = fs::recursive_directory_iterator(dirPath);
+         it != fs::recursive_directory_iterator(); ++it) {
+      if (!it->is_directory()) {
+        continue;
+      }
+
+      if (std::string(it->path().filename())[0] == '.') {
+        it.disable_recursion_pending();
+        continue;
+      }
+
+      mountPaths.push_back(it->path());
+    }
+  }
+
+  std::sort(mountPaths.begin(), mountPaths.end());
+
+  std::unordered_set<std::string> seen;
+  for (const std::string &mountPath : mountPaths) {
+    if (seen.insert(mountKey(mountPath)).second) {
+      mounts.push_back(StoreMount{mountPath});
+    }
   }
 
   getStored();
 }
 
+// Stores are read in parallel and then joined in mount order
 bool ImageList::getStored() {
+  std::vector<image_store> stores(mounts.size());
+  std::atomic_int mountIndex(0);
+  std::exception_ptr readError;
+  std::mutex readErrorMutex;
+
+  auto threadFn = [&]() {
+    while (true) {
+      int i = mountIndex++;
+      if (i >= mounts.size()) {
+        break;
+      }
+
+      try {
+        readStore(i, &stores[i]);
+      } catch (...) {
+        std::lock_guard<std::mutex> readErrorLock(readErrorMutex);
+        readError = std::current_exception();
+      }
+    }
+  };
+
+  int threads = std::min(
+      (size_t)std::max(1, (int)std::thread::hardware_concurrency()),
+      mounts.size());
+  std::vector<std::thread> threadVector;
+  threadVector.reserve(threads);
+  for (int i = 0; i < threads; ++i) {
+    threadVector.emplace_back(threadFn);
+  }
+  for (std::thread &t : threadVector) {
+    if (t.joinable()) {
+      t.join();
+    }
+  }
+
+  if (readError) {
+    std::rethrow_exception(readError);
+  }
+
+  bool anyStored = false;
+  for (int i = 0; i < mounts.size(); ++i) {
+    anyStored |= mounts[i].hasStore;
+    for (const std::shared_ptr<EdgedImage> &image : stores[i]) {
+      imageMounts[image->path] = i;
+    }
+    store.insert(store.end(), stores[i].begin(), stores[i].end());
+  }
+
+  return anyStored;
+}
+
+bool ImageList::readStore(int mount, image_store *images) {
   namespace fs = std::filesystem;
 
-  fs::path storePath{dirPath};
+  fs::path storePath{mounts[mount].dirPath};
   storePath.append(".store");
   std::ifstream storeFile(storePath);
   if (!storeFile) {
     return false;
   }
 
+  std::error_code error;
+  mounts[mount].hasStore = true;
+  mounts[mount].storeModified = fs::last_write_time(storePath, error);
+
+  // Read in one go so the edges file can be checked against it
+  std::stringstream storeText;
+  storeText << storeFile.rdbuf();
+  storeFile.close();
+
+  std::shared_ptr<EdgeArena> mapped;
+  if (mapEdges) {
+    fs::path edgesPath{mounts[mount].dirPath};
+    edgesPath.append(".edges");
+    mapped = EdgeArena::map(edgesPath, EdgeArena::storeHash(storeText.str()));
+  }
+
   std::string line;
+  size_t lineIndex = 0;
 
-  while (std::getline(storeFile, line)) {
+  while (std::getline(storeText, line)) {
     std::string path;
     int width, height, bitsetSize;
     boost::dynamic_bitset<unsigned char> edges;
+    std::shared_ptr<EdgeRuns> runs;
+    bool useMapped = false;
 
     int detectionMode, detectionBlurSize, detectionBlurSigmaX,
         detectionBlurSigmaY, detectionCannyThreshold1, detectionCannyThreshold2,
         detectionCannyJoinByX, detectionCannyJoinByY, detectionBinaryThreshold;
+    // Added later, so might not be in older stores
+    int orientation = 1;
+    int serial = -1;
 
     std::stringstream lineStream(line);
     int i = 0;
@@ -47,7 +234,15 @@ bool ImageList::getStored() {
       } else if (i == 3) {
         bitsetSize = std::stoi(substr);
       } else if (i == 4) {
-        edges = stringToBitset(substr.c_str(), bitsetSize);
+        // No need to parse edges that are already mapped
+        useMapped = mapped && lineIndex < mapped->count() &&
+                    mapped->edgeCounts[lineIndex] == bitsetSize;
+        if (!useMapped && substr[0] == 'R') {
+          runs = std::make_shared<EdgeRuns>(
+              EdgeRuns::fromString(substr.c_str() + 1, bitsetSize));
+        } else if (!useMapped) {
+          edges = stringToBitset(substr.c_str(), bitsetSize);
+        }
       } else if (i == 5) {
         detectionMode = std::stoi(substr);
       } else if (i == 6) {
@@ -66,149 +261,704 @@ bool ImageList::getStored() {
         detectionCannyJoinByX = std::stoi(substr);
       } else if (i == 13) {
         detectionCannyJoinByY = std::stoi(substr);
+      } else if (i == 14) {
+        orientation = std::stoi(substr);
+      } else if (i == 15) {
+        serial = std::stoi(substr);
       }
 
       ++i;
     }
 
-    store.push_back(std::make_shared<EdgedImage>(
+    auto image = std::make_shared<EdgedImage>(
         path, width, height, edges, detectionMode, detectionBlurSize,
         detectionBlurSigmaX, detectionBlurSigmaY, detectionCannyThreshold1,
         detectionCannyThreshold2, detectionCannyJoinByX, detectionCannyJoinByY,
-        detectionBinaryThreshold));
-  }
+        detectionBinaryThreshold, orientation);
 
-  storeFile.close();
+    // Stores from before serials are numbered in the order they were saved in
+    image->serial = serial == -1 ? lineIndex : serial;
+    mounts[mount].nextSerial =
+        std::max(mounts[mount].nextSerial, image->serial + 1);
+
+    if (useMapped) {
+      image->viewEdges(mapped, mapped->edgesAt(lineIndex), bitsetSize);
+    } else if (runs) {
+      image->useRuns(runs);
+    }
+
+    images->push_back(image);
+    lineIndex++;
+  }
 
   return true;
 }
 
-void ImageList::generate() {
+// Picks up images that another process (e.g. `process_images` in watch mode)
+// has added to the store since it was read. Existing images are left alone so
+// that pointers to them stay valid
+int ImageList::refresh() {
   namespace fs = std::filesystem;
 
-  store.clear();
+  std::unordered_set<std::string> existing;
+  for (const std::shared_ptr<EdgedImage> &image : store) {
+    existing.insert(image->path);
+  }
+
+  int added = 0;
+
+  for (int i = 0; i < mounts.size(); ++i) {
+    fs::path storePath{mounts[i].dirPath};
+    storePath.append(".store");
+    std::error_code error;
+    auto modified = fs::last_write_time(storePath, error);
+    if (error || modified == mounts[i].storeModified) {
+      continue;
+    }
 
-  for (const auto &file : fs::directory_iterator(dirPath)) {
-    if (std::string(file.path().filename())[0] == '.') {
-      std::cout << "Skipping: " << file.path() << '\n';
+    image_store stored;
+    if (!readStore(i, &stored)) {
       continue;
     }
 
-    addFile(file);
+    for (std::shared_ptr<EdgedImage> &image : stored) {
+      if (!existing.count(image->path)) {
+        imageMounts[image->path] = i;
+        store.push_back(std::move(image));
+        added++;
+      }
+    }
   }
+
+  return added;
 }
 
-int ImageList::sync() {
+// For images processed before previews were made at the same time
+int ImageList::generatePreviews() {
   namespace fs = std::filesystem;
 
-  int added = 0;
+  std::vector<std::string> paths;
+  for (const std::shared_ptr<EdgedImage> &image : store) {
+    fs::path path{image->path};
+    if (!PreviewPack::forDirectory(path.parent_path())->has(path.filename())) {
+      paths.push_back(image->path);
+    }
+  }
 
-  for (const auto &file : fs::directory_iterator(dirPath)) {
-    if (std::string(file.path().filename())[0] == '.') {
-      continue;
+  std::atomic_int added(0);
+  BulkReader reader;
+  reader.read(paths, [&](size_t i, std::vector<uchar> &buffer) {
+    ReducedImage source = decodeImageReduced(
+        buffer, probeImage(buffer.data(), buffer.size()), PREVIEW_WIDTH);
+    if (source.image.empty()) {
+      std::cout << "Skipping: " << paths[i] << " (cannot read)\n";
+      return;
     }
 
-    bool exists = false;
-    for (const std::shared_ptr<EdgedImage> &image : store) {
-      if (image->path == std::string(file.path())) {
-        exists = true;
-        break;
+    PreviewPack::savePreview(paths[i], source.image);
+    added++;
+  });
+
+  return added;
+}
+
+std::vector<std::string> ImageList::mountPaths() const {
+  std::vector<std::string> paths;
+  for (const StoreMount &mount : mounts) {
+    paths.push_back(mount.dirPath);
+  }
+  return paths;
+}
+
+int ImageList::idOf(const EdgedImage &image) const {
+  return mountFor(image.path) * IMAGE_ID_MOUNT_STRIDE + image.serial;
+}
+
+// Or end() if there's no image with that ID
+ImageList::image_store::iterator ImageList::find(int id) {
+  return std::find_if(store.begin(), store.end(),
+                      [&](const std::shared_ptr<EdgedImage> &image) {
+                        return idOf(*image) == id;
+                      });
+}
+
+// Paths from directory listings, skipping hidden files and directories, along
+// with the mount each one was listed from
+std::vector<std::string>
+ImageList::listFiles(std::vector<int> *fileMounts) const {
+  namespace fs = std::filesystem;
+
+  std::vector<std::string> paths;
+  for (int i = 0; i < mounts.size(); ++i) {
+    for (const auto &file : fs::directory_iterator(mounts[i].dirPath)) {
+      if (std::string(file.path().filename())[0] == '.' ||
+          !file.is_regular_file()) {
+        continue;
       }
+
+      paths.push_back(file.path());
+      fileMounts->push_back(i);
+    }
+  }
+
+  return paths;
+}
+
+// Only for paths that come straight from a mount's directory, or -1. Paths in
+// a store might not match their directory, e.g. if it has been moved, so
+// images already in the store are looked up in imageMounts instead
+int ImageList::mountFor(const std::string &imagePath) const {
+  auto known = imageMounts.find(imagePath);
+  if (known != imageMounts.end()) {
+    return known->second;
+  }
+
+  std::string key = mountKey(std::filesystem::path(imagePath).parent_path());
+  for (int i = 0; i < mounts.size(); ++i) {
+    if (mountKey(mounts[i].dirPath) == key) {
+      return i;
     }
-    if (exists) {
+  }
+
+  return -1;
+}
+
+void ImageList::generate() {
+  namespace fs = std::filesystem;
+
+  store.clear();
+  imageMounts.clear();
+  decodeStats = DecodeStats();
+
+  // Starting again from the directories, so a store can end up empty
+  for (StoreMount &mount : mounts) {
+    mount.emptied = true;
+    mount.nextSerial = 0;
+  }
+
+  std::vector<int> fileMounts;
+  std::vector<std::string> paths = listFiles(&fileMounts);
+
+  BulkReader reader;
+  reader.read(paths, [&](size_t i, std::vector<uchar> &buffer) {
+    addFile(paths[i], fileMounts[i], probeImage(buffer.data(), buffer.size()),
+            buffer);
+  });
+}
+
+int ImageList::sync() {
+  namespace fs = std::filesystem;
+
+  decodeStats = DecodeStats();
+
+  // Probe the new files first so we know how much work there is before
+  // decoding anything
+  std::vector<std::pair<fs::path, ImageProbe>> toAdd;
+  std::vector<int> toAddMounts;
+  double megapixels = 0;
+  double toDecodeMegapixels = 0;
+
+  std::unordered_set<std::string> existing;
+  for (const std::shared_ptr<EdgedImage> &image : store) {
+    existing.insert(image->path);
+  }
+
+  std::vector<int> fileMounts;
+  std::vector<std::string> files = listFiles(&fileMounts);
+  for (int f = 0; f < files.size(); ++f) {
+    const std::string &path = files[f];
+    if (existing.count(path)) {
       continue;
     }
 
-    addFile(file);
-    added++;
+    // Formats the probe doesn't understand are left for OpenCV to try
+    ImageProbe probe = probeImage(path);
+    if (probe.format != ImageFormat_Unknown && !probe.valid()) {
+      std::cout << "Skipping: " << path << " (not a readable image)\n";
+      continue;
+    }
+
+    megapixels += probe.storedWidth * probe.storedHeight / 1e6;
+    toDecodeMegapixels += ingestMegapixels(path, probe);
+
+    toAdd.emplace_back(path, probe);
+    toAddMounts.push_back(fileMounts[f]);
   }
 
+  if (!toAdd.empty()) {
+    std::cout << "Found " << toAdd.size() << " new images (" << megapixels
+              << "MP, " << toDecodeMegapixels << "MP to decode)\n";
+  }
+
+  std::vector<std::string> paths;
+  for (const auto &[path, probe] : toAdd) {
+    paths.push_back(path);
+  }
+
+  int added = 0;
+  BulkReader reader;
+  reader.read(paths, [&](size_t i, std::vector<uchar> &buffer) {
+    if (addFile(paths[i], toAddMounts[i], toAdd[i].second, buffer)) {
+      added++;
+    }
+  });
+
   return added;
 }
 
-void ImageList::addFile(const std::filesystem::directory_entry &file) {
-  std::cout << "Reading: " << file.path();
+bool ImageList::addFile(const std::filesystem::path &path, int mount,
+                        const ImageProbe &probe,
+                        const std::vector<uchar> &buffer) {
+  std::cout << "Reading: " << path;
+
+  if (probe.format != ImageFormat_Unknown && !probe.valid()) {
+    std::cout << " (skipping, cannot read)\n";
+    return false;
+  }
 
-  cv::Mat sourceImage = cv::imread(file.path());
+  bool preview = wantsPreview(path);
+  ReducedImage source =
+      decodeImageReduced(buffer, probe, detectionWidth(preview));
 
-  if (sourceImage.empty()) {
+  if (source.image.empty()) {
     std::cout << " (skipping, cannot read)\n";
-    return;
+    return false;
+  } else if (source.reduction != 1) {
+    std::cout << " (decoded at 1/" << source.reduction << ")\n";
   } else {
     std::cout << '\n';
   }
 
-  auto edgesMat = detectEdgesCanny(sourceImage);
+  decodeStats.add(source);
+  imageMounts[path] = mount;
+  store.push_back(edgedImageFrom(path, probe, source));
+  store.back()->serial = mounts[mount].nextSerial++;
+
+  if (preview) {
+    makePreview(path, probe, buffer, source);
+  }
+
+  return true;
+}
+
+std::shared_ptr<EdgedImage>
+ImageList::edgedImageFrom(const std::string &path, const ImageProbe &probe,
+                          const ReducedImage &source) {
+  auto edgesMat = detectEdgesCanny(source.image, {source.width, source.height});
   auto edges = edgesToBitset(edgesMat);
-  store.push_back(std::make_shared<EdgedImage>(file.path(), sourceImage.cols,
-                                               sourceImage.rows, edges));
+  return std::make_shared<EdgedImage>(
+      path, source.width, source.height, edges, ImageEdgeMode_Canny,
+      EDGE_DETECTION_BLUR_SIZE, EDGE_DETECTION_BLUR_SIGMA_X,
+      EDGE_DETECTION_BLUR_SIGMA_Y, EDGE_DETECTION_CANNY_THRESHOLD_1,
+      EDGE_DETECTION_CANNY_THRESHOLD_2, EDGE_DETECTION_CANNY_JOIN_BY_X,
+      EDGE_DETECTION_CANNY_JOIN_BY_Y, EDGE_DETECTION_BINARY_THRESHOLD,
+      probe.orientation);
+}
+
+// Runs until `stop` is set, adding images to the store as they appear in the
+// directory. Edge detection happens on low priority threads so that it
+// doesn't get in the way of anything interactive, and the store is saved
+// after every batch so that running `match` sessions can pick them up
+void ImageList::watch(const std::atomic_bool &stop) {
+  namespace fs = std::filesystem;
+
+  DirectoryWatcher watcher(mountPaths());
+
+  while (!stop) {
+    std::vector<std::string> changed = watcher.waitForChanges();
+
+    std::unordered_set<std::string> existing;
+    for (const std::shared_ptr<EdgedImage> &image : store) {
+      existing.insert(image->path);
+    }
+
+    std::vector<std::string> paths;
+    std::vector<int> pathMounts;
+    std::vector<ImageProbe> probes;
+    for (const std::string &changedPath : changed) {
+      fs::path path{changedPath};
+      if (std::string(path.filename())[0] == '.') {
+        continue;
+      }
+
+      if (existing.count(path) || !fs::is_regular_file(path)) {
+        continue;
+      }
+
+      // The watcher joins the mount's own path with the file name, so this
+      // always finds it
+      int mount = mountFor(path);
+      if (mount == -1) {
+        continue;
+      }
+
+      ImageProbe probe = probeImage(path);
+      if (probe.format != ImageFormat_Unknown && !probe.valid()) {
+        std::cout << "Skipping: " << path << " (not a readable image)\n";
+        continue;
+      }
+
+      paths.push_back(path);
+      pathMounts.push_back(mount);
+      probes.push_back(probe);
+    }
+
+    if (paths.empty()) {
+      continue;
+    }
+
+    std::cout << "Detecting edges for " << paths.size() << " new images\n";
+
+    image_store detected(paths.size());
+    std::atomic_int imageIndex(0);
+
+    auto threadFn = [&]() {
+#ifdef __linux__
+      // Only affects this thread on Linux
+      setpriority(PRIO_PROCESS, syscall(SYS_gettid), WATCH_NICENESS);
+#endif
+
+      while (true) {
+        int i = imageIndex++;
+        if (i >= paths.size()) {
+          break;
+        }
+
+        std::vector<uchar> buffer = BulkReader::readFile(paths[i]);
+        bool preview = wantsPreview(paths[i]);
+        ReducedImage source =
+            decodeImageReduced(buffer, probes[i], detectionWidth(preview));
+        if (!source.image.empty()) {
+          detected[i] = edgedImageFrom(paths[i], probes[i], source);
+
+          if (preview) {
+            makePreview(paths[i], probes[i], buffer, source);
+          }
+        }
+      }
+    };
+
+    int threads = std::min((size_t)std::max(
+                               1, (int)std::thread::hardware_concurrency() - 1),
+                           paths.size());
+    std::vector<std::thread> threadVector;
+    threadVector.reserve(threads);
+    for (int i = 0; i < threads; ++i) {
+      threadVector.emplace_back(threadFn);
+    }
+    for (std::thread &t : threadVector) {
+      if (t.joinable()) {
+        t.join();
+      }
+    }
+
+    int added = 0;
+    for (int i = 0; i < paths.size(); ++i) {
+      if (detected[i]) {
+        imageMounts[paths[i]] = pathMounts[i];
+        detected[i]->serial = mounts[pathMounts[i]].nextSerial++;
+        store.push_back(detected[i]);
+        added++;
+      } else {
+        std::cout << "Skipping: " << paths[i] << " (cannot read)\n";
+      }
+    }
+
+    if (added) {
+      save(false);
+      std::cout << "Added " << added << " images to store\n";
+    }
+  }
 }
 
 // If saving before quitting, make sure you call async=false or you might
-// destroy the store file
+// lose the changes. The store is written to a temporary file and renamed over
+// the old one, so other processes reading it never see half a store. Each
+// image goes back to the mount it came from, and a store that had images is
+// never emptied unless they were removed on purpose
 void ImageList::save(bool async) {
-  auto threadFn = [&]() {
-    std::filesystem::path storePath{dirPath};
-    storePath.append(".store");
-    std::ofstream storeFile(storePath);
-    if (!storeFile) {
-      throw std::runtime_error("Failed to open store file.");
+  static std::atomic_int saveCount(0);
+
+  // Everything the save needs is copied here, so that an async save doesn't
+  // race with the store changing underneath it
+  std::vector<image_store> byMount(mounts.size());
+  for (const std::shared_ptr<EdgedImage> &image : store) {
+    int mount = mountFor(image->path);
+    if (mount == -1) {
+      throw std::runtime_error("No store to save image to: " + image->path);
     }
+    byMount[mount].push_back(image);
+  }
 
-    for (const std::shared_ptr<EdgedImage> &image : store) {
-      storeFile << *image << '\n';
+  std::vector<std::string> dirPaths;
+  for (int i = 0; i < mounts.size(); ++i) {
+    bool written = !byMount[i].empty() || mounts[i].emptied ||
+                   (!mounts[i].hasStore && mounts.size() == 1);
+    // Don't litter empty stores through every subdirectory, or wipe out a
+    // store just because its images weren't read
+    dirPaths.push_back(written ? mounts[i].dirPath : "");
+    if (written) {
+      mounts[i].hasStore = true;
+      mounts[i].emptied = false;
+    }
+  }
+
+  auto threadFn = [byMount = std::move(byMount),
+                   dirPaths = std::move(dirPaths)]() {
+    for (int i = 0; i < dirPaths.size(); ++i) {
+      if (dirPaths[i].empty()) {
+        continue;
+      }
+
+      std::filesystem::path storePath{dirPaths[i]};
+      storePath.append(".store");
+      std::filesystem::path tmpPath{dirPaths[i]};
+      tmpPath.append(".store." + std::to_string(saveCount++) + ".tmp");
+
+      std::ofstream storeFile(tmpPath);
+      if (!storeFile) {
+        throw std::runtime_error("Failed to open store file.");
+      }
+
+      std::stringstream storeText;
+      std::vector<EdgedImage *> images;
+      for (const std::shared_ptr<EdgedImage> &image : byMount[i]) {
+        storeText << *image << '\n';
+        images.push_back(image.get());
+      }
+
+      storeFile << storeText.rdbuf();
+      storeFile.close();
+      std::filesystem::rename(tmpPath, storePath);
+
+      // Same edges again in binary, so they can be mapped rather than parsed.
+      // It's tagged with a hash of the store, so if the store is rewritten
+      // without it (or this save doesn't finish) it's ignored. Only needed if
+      // anything maps it, and only rewritten if the store has changed
+      if (!MATCH_OUT_OF_CORE) {
+        continue;
+      }
+
+      std::filesystem::path edgesPath{dirPaths[i]};
+      edgesPath.append(".edges");
+      uint64_t storeHash = EdgeArena::storeHash(storeText.str());
+      if (EdgeArena::writtenWith(edgesPath, storeHash)) {
+        continue;
+      }
+
+      std::filesystem::path edgesTmpPath{dirPaths[i]};
+      edgesTmpPath.append(".edges." + std::to_string(saveCount++) + ".tmp");
+
+      EdgeArena::write(edgesTmpPath, images, storeHash);
+      std::filesystem::rename(edgesTmpPath, edgesPath);
     }
   };
 
   if (async) {
-    std::thread saveThread(threadFn);
+    std::thread saveThread([threadFn = std::move(threadFn)]() {
+      try {
+        threadFn();
+      } catch (const std::exception &error) {
+        std::cerr << "Failed to save store: " << error.what() << '\n';
+      }
+    });
     saveThread.detach();
   } else {
     threadFn();
   }
 }
 
+// Moves the edges of everything currently in the store into one arena. Images
+// added afterwards keep their own edges until this is called again
+void ImageList::useArena(bool hugePages) {
+  arena = EdgeArena::adopt(store, hugePages);
+}
+
+// Run length encodes the edges of everything in the store
+void ImageList::useRuns() {
+  for (const std::shared_ptr<EdgedImage> &image : store) {
+    image->compressEdges();
+  }
+  arena.reset();
+}
+
+// Unpacks every image's edges, the same as matching does, to measure how fast
+// the store can be walked
+ScanStats ImageList::scanEdges() const {
+  ScanStats stats;
+
+  size_t maxEdges = 0;
+  for (const std::shared_ptr<EdgedImage> &image : store) {
+    maxEdges = std::max(maxEdges, image->edgeCount());
+  }
+  std::vector<uchar> scratch(maxEdges);
+
+  auto start = std::chrono::high_resolution_clock::now();
+
+  size_t edgePixels = 0;
+  for (const std::shared_ptr<EdgedImage> &image : store) {
+    image->unpackEdges(scratch.data());
+    edgePixels += std::count(scratch.begin(),
+                             scratch.begin() + image->edgeCount(), 255);
+    stats.edgeBytes += (image->edgeCount() + 7) / 8;
+    stats.memoryBytes += image->memoryBytes();
+    stats.images++;
+  }
+
+  auto finish = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<float> elapsed = finish - start;
+  stats.seconds = elapsed.count();
+
+  if (arena) {
+    stats.memoryBytes += arena->bytes();
+  }
+
+  for (const std::shared_ptr<EdgedImage> &image : store) {
+    if (image->edgeRuns()) {
+      stats.runBytes += image->edgeRuns()->memoryBytes();
+      stats.runTextBytes += image->edgeRuns()->toString().size() + 1;
+      stats.hexTextBytes += (image->edgeCount() + 3) / 4;
+    }
+  }
+
+  // Stops the compiler optimising the whole thing out
+  if (edgePixels == (size_t)-1) {
+    std::cout << '\n';
+  }
+
+  return stats;
+}
+
 void ImageList::provideMatchContext(int templateOffsetX, int templateOffsetY) {
   _matchContextOffsetX = templateOffsetX;
   _matchContextOffsetY = templateOffsetY;
 }
+void ImageList::provideMatchOptions(const MatchOptions &options) {
+  _matchOptions = options;
+}
+// Or nullptr to match the template pixel by pixel again
+void ImageList::provideVectorTemplate(
+    std::shared_ptr<const VectorTemplate> shapes) {
+  _vectorTemplate = std::move(shapes);
+}
 void ImageList::resetMatchContext() {
   _matchContextOffsetX = 0;
   _matchContextOffsetY = 0;
 }
 
+// Advises on the mapped edges of images [first, last), merging neighbours that
+// sit next to each other in the same file into one call
+static void adviseEdges(const ImageList::image_store &store, size_t first,
+                        size_t last, bool willNeed) {
+  const uchar *begin = nullptr;
+  const uchar *end = nullptr;
+
+  for (size_t i = first; i < last; ++i) {
+    if (!store[i]->edgesFileBacked()) {
+      continue;
+    }
+
+    const uchar *packed = store[i]->packedEdges();
+    size_t bytes = (store[i]->edgeCount() + 7) / 8;
+
+    if (begin && packed >= end && packed < end + 64) {
+      end = packed + bytes;
+      continue;
+    }
+
+    if (begin) {
+      EdgeArena::advise(begin, end, willNeed);
+    }
+    begin = packed;
+    end = packed + bytes;
+  }
+
+  if (begin) {
+    EdgeArena::advise(begin, end, willNeed);
+  }
+}
+
 int ImageList::matchTo(const cv::Mat &templateImage, ImageMatch *bestMatch,
                        EdgedImage **bestMatchImage, float offsetScaleStep,
                        int offsetXStep, int offsetYStep, float minOffsetScale,
                        int maxOffset, float whiteBias) {
+  // Before any threads start, as they can't throw
+  if (_vectorTemplate && !canMatchOutline(_matchOptions)) {
+    throw std::runtime_error(
+        "Vector templates can only be matched upright, without angles.");
+  }
+
   std::atomic_int runs(0);
   int maxThreads = std::thread::hardware_concurrency() - 1;
   if (maxThreads == -1) {
     throw std::runtime_error("hardware_concurrency() returning 0, unsupported");
   }
-  int threads = std::min(maxThreads, count());
 
-  std::vector<std::thread> threadVector;
-  threadVector.reserve(threads);
+  // Mapped edges are scored a chunk at a time so that no more than the budget
+  // is resident: the next chunk is read ahead while this one is scored, and
+  // then this one is dropped. Edges already in memory don't count
+  size_t chunkBytes = (size_t)MATCH_RESIDENT_BUDGET_MB * 1048576 / 2;
+  std::vector<size_t> chunkStarts = {0};
+  size_t bytes = 0;
+  for (size_t i = 0; i < store.size(); ++i) {
+    if (!store[i]->edgesFileBacked()) {
+      continue;
+    }
+
+    size_t imageBytes = (store[i]->edgeCount() + 7) / 8;
+    if (bytes && bytes + imageBytes > chunkBytes) {
+      chunkStarts.push_back(i);
+      bytes = 0;
+    }
+    bytes += imageBytes;
+  }
+  chunkStarts.push_back(store.size());
 
   std::atomic_int imageIndex(0);
+  int lastIndex = 0;
   std::mutex bestMatchMutex;
 
-  auto threadFn = [&]() {
+  if (matchScratch.size() < maxThreads) {
+    matchScratch.resize(maxThreads);
+  }
+
+  // Every rotation of the template, made once for all the images
+  std::shared_ptr<const TemplateBank> bank;
+  if (_matchOptions.angleRange > 0) {
+    bank = std::make_shared<TemplateBank>(
+        templateImage, _matchContextOffsetX, _matchContextOffsetY,
+        _matchOptions.orientations, _matchOptions.angleRange,
+        _matchOptions.angleStep, _matchOptions.sequential);
+  }
+
+  // Likewise the points along a vector template's outline
+  std::shared_ptr<const std::vector<cv::Point2f>> outline;
+  if (_vectorTemplate) {
+    outline = _vectorTemplate->placedOutline(
+        _matchContextOffsetX, _matchContextOffsetY, templateImage.size());
+  }
+
+  auto threadFn = [&](int thread) {
     while (true) {
       int indexToGet = imageIndex++;
-      if (indexToGet > store.size() - 1) {
+      if (indexToGet >= lastIndex) {
         break;
       }
       std::shared_ptr<EdgedImage> sourceImage = store[indexToGet];
 
       sourceImage->provideMatchContext(_matchContextOffsetX,
                                        _matchContextOffsetY);
+      sourceImage->provideMatchOptions(_matchOptions);
+      sourceImage->provideTemplateBank(bank);
+      sourceImage->provideVectorTemplate(_vectorTemplate);
+      sourceImage->provideOutline(outline);
 
       ImageMatch match;
       runs += sourceImage->matchTo(templateImage, &match, offsetScaleStep,
                                    offsetXStep, offsetYStep, minOffsetScale,
-                                   maxOffset, whiteBias);
+                                   maxOffset, whiteBias, &matchScratch[thread]);
+      sourceImage->provideTemplateBank(nullptr);
+      sourceImage->provideOutline(nullptr);
 
       std::lock_guard<std::mutex> bestMatchLock(bestMatchMutex);
 
@@ -219,12 +969,33 @@ int ImageList::matchTo(const cv::Mat &templateImage, ImageMatch *bestMatch,
     }
   };
 
-  for (int i = 0; i < threads; ++i) {
-    threadVector.emplace_back(threadFn);
-  }
-  for (std::thread &t : threadVector) {
-    if (t.joinable()) {
-      t.join();
+  adviseEdges(store, chunkStarts[0], chunkStarts[1], true);
+
+  for (size_t chunk = 0; chunk + 1 < chunkStarts.size(); ++chunk) {
+    size_t first = chunkStarts[chunk];
+    size_t last = chunkStarts[chunk + 1];
+
+    if (chunk + 2 < chunkStarts.size()) {
+      adviseEdges(store, last, chunkStarts[chunk + 2], true);
+    }
+
+    imageIndex = first;
+    lastIndex = last;
+    int threads = std::min((size_t)maxThreads, last - first);
+
+    std::vector<std::thread> threadVector;
+    threadVector.reserve(threads);
+    for (int i = 0; i < threads; ++i) {
+      threadVector.emplace_back(threadFn, i);
+    }
+    for (std::thread &t : threadVector) {
+      if (t.joinable()) {
+        t.join();
+      }
+    }
+
+    if (chunkStarts.size() > 2) {
+      adviseEdges(store, first, last, false);
     }
   }
 
@@ -260,7 +1031,26 @@ ImageList::image_store::reference ImageList::at(size_t pos) {
 }
 
 void ImageList::erase(size_t pos) {
+  int mount = mountFor(store.at(pos)->path);
+  if (mount != -1) {
+    mounts[mount].emptied = true;
+  }
   store.erase(begin() + pos);
 }
 
 int ImageList::count() const { return store.size(); }
+
+std::ostream &operator<<(std::ostream &os, const ScanStats &stats) {
+  os << "Scanned " << stats.images << " images in " << stats.seconds * 1000
+     << "ms (" << stats.edgeBytes / 1048576.f / stats.seconds << "MB/s, "
+     << (stats.images ? stats.memoryBytes / stats.images : 0)
+     << " bytes per image)";
+
+  if (stats.runBytes) {
+    os << ", runs are " << 100.f * stats.runBytes / stats.edgeBytes
+       << "% the size of packed edges in memory and "
+       << 100.f * stats.runTextBytes / stats.hexTextBytes
+       << "% the size of hex in the store";
+  }
+  return os;
+}
@@ -5,13 +5,27 @@
 #include <filesystem>
 #include <fstream>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "../precompiled.h"
 
 #include "detect-edge.hpp"
+#include "directory-watcher.hpp"
+#include "edge-arena.hpp"
 #include "edged-image.hpp"
+#include "preview-pack.hpp"
 #include "image-list.hpp"
+#include "read-image.hpp"
+
+struct ScanStats {
+  int images = 0;
+  float seconds = 0;
+  size_t edgeBytes = 0, memoryBytes = 0;
+  // Only for images with run length encoded edges
+  size_t runBytes = 0, runTextBytes = 0, hexTextBytes = 0;
+};
 
 class ImageList {
 public:
@@ -19,22 +33,69 @@ public:
   typedef std::function<bool(std::shared_ptr<EdgedImage>, std::shared_ptr<EdgedImage>)> sort_predicate;
 
 private:
-  std::string dirPath;
+  struct StoreMount {
+    std::string dirPath;
+    bool hasStore = false;
+    std::filesystem::file_time_type storeModified;
+    // Images were removed on purpose, so saving an empty store is expected
+    bool emptied = false;
+    // Given to the next image added to this store
+    int nextSerial = 0;
+  };
+
+  std::vector<StoreMount> mounts;
+  // Which mount each image path was read from or added to
+  std::unordered_map<std::string, int> imageMounts;
+  std::shared_ptr<EdgeArena> arena;
+  bool mapEdges;
+  // One per matching thread, kept between queries
+  std::vector<MatchScratch> matchScratch;
   int _matchContextOffsetX;
   int _matchContextOffsetY;
+  MatchOptions _matchOptions;
+  std::shared_ptr<const VectorTemplate> _vectorTemplate;
 
   bool getStored();
-  void addFile(const std::filesystem::directory_entry &file);
+  bool readStore(int mount, image_store *images);
+  std::vector<std::string> listFiles(std::vector<int> *fileMounts) const;
+  int mountFor(const std::string &imagePath) const;
+  bool addFile(const std::filesystem::path &path, int mount,
+               const ImageProbe &probe, const std::vector<uchar> &buffer);
+  static std::shared_ptr<EdgedImage> edgedImageFrom(const std::string &path,
+                                                    const ImageProbe &probe,
+                                                    const ReducedImage &source);
 
 public:
   image_store store;
-  ImageList(std::string dirPath);
+  DecodeStats decodeStats;
+  // The store holds the images from every mounted directory in mount order.
+  // Each image's ID comes from its mount and its serial in that mount's store,
+  // so it doesn't change when images are added, removed or sorted, or between
+  // runs given the same directories. If mapEdges, edges are mapped from disk
+  // rather than read into memory
+  ImageList(std::string dirPath, bool recursive = false,
+            bool mapEdges = false);
+  ImageList(const std::vector<std::string> &dirPaths, bool recursive = false,
+            bool mapEdges = false);
+
+  std::vector<std::string> mountPaths() const;
+  int idOf(const EdgedImage &image) const;
+  image_store::iterator find(int id);
 
   void generate();
   void save(bool async = true);
   int sync();
+  int refresh();
+  int generatePreviews();
+  void watch(const std::atomic_bool &stop);
+
+  void useArena(bool hugePages = EDGE_ARENA_HUGE_PAGES);
+  void useRuns();
+  ScanStats scanEdges() const;
 
   void provideMatchContext(int templateOffsetX, int templateOffsetY);
+  void provideMatchOptions(const MatchOptions &options);
+  void provideVectorTemplate(std::shared_ptr<const VectorTemplate> shapes);
   void resetMatchContext();
 
   int matchTo(const cv::Mat &templateImage, ImageMatch *match,
@@ -56,3 +117,5 @@ public:
   void erase(size_t pos);
   int count() const;
 };
+
+std::ostream& operator<<(std::ostream& os, const ScanStats& stats);
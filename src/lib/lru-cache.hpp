@@ -0,0 +1,143 @@
+#pragma once
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "../precompiled.h"
+
+struct LruCacheStats {
+  size_t hits = 0, misses = 0, evictions = 0;
+  size_t entries = 0, bytes = 0, budget = 0;
+};
+
+// Keeps values up to a total cost (usually bytes), throwing out whatever was
+// used least recently to make room. Safe to share between threads. Values are
+// shared_ptrs, so one that's evicted while it's still in use stays alive until
+// it's finished with
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class LruCache {
+  struct Entry {
+    Key key;
+    std::shared_ptr<Value> value;
+    size_t cost;
+  };
+  typedef std::list<Entry> entry_list;
+
+  // Most recently used first
+  entry_list entries;
+  std::unordered_map<Key, typename entry_list::iterator, Hash> index;
+  mutable std::mutex mutex;
+  LruCacheStats stats;
+
+  // Call with the lock held
+  std::shared_ptr<Value> evictOldest() {
+    Entry &oldest = entries.back();
+    std::shared_ptr<Value> value = std::move(oldest.value);
+    stats.bytes -= oldest.cost;
+    stats.evictions++;
+    index.erase(oldest.key);
+    entries.pop_back();
+    return value;
+  }
+
+public:
+  LruCache(size_t budget) { stats.budget = budget; }
+
+  std::shared_ptr<Value> get(const Key &key) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = index.find(key);
+    if (it == index.end()) {
+      stats.misses++;
+      return nullptr;
+    }
+
+    stats.hits++;
+    entries.splice(entries.begin(), entries, it->second);
+    return it->second->value;
+  }
+
+  // Same as get, but doesn't count towards the stats or make it more recent
+  std::shared_ptr<Value> peek(const Key &key) const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = index.find(key);
+    return it == index.end() ? nullptr : it->second->value;
+  }
+
+  // Values that cost more than the whole budget aren't kept
+  void put(const Key &key, std::shared_ptr<Value> value, size_t cost) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = index.find(key);
+    if (it != index.end()) {
+      stats.bytes -= it->second->cost;
+      entries.erase(it->second);
+      index.erase(it);
+    }
+
+    if (cost > stats.budget) {
+      return;
+    }
+
+    while (stats.bytes + cost > stats.budget) {
+      evictOldest();
+    }
+
+    entries.push_front(Entry{key, std::move(value), cost});
+    index[key] = entries.begin();
+    stats.bytes += cost;
+  }
+
+  // Makes room for a value of `cost`. If the last value thrown out isn't in
+  // use anywhere else it's returned, so that it can be reused for the new one
+  std::shared_ptr<Value> reclaim(size_t cost) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::shared_ptr<Value> reclaimed;
+    while (!entries.empty() && stats.bytes + cost > stats.budget) {
+      reclaimed = evictOldest();
+    }
+
+    if (reclaimed && reclaimed.use_count() == 1) {
+      return reclaimed;
+    }
+    return nullptr;
+  }
+
+  void erase(const Key &key) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = index.find(key);
+    if (it != index.end()) {
+      stats.bytes -= it->second->cost;
+      entries.erase(it->second);
+      index.erase(it);
+    }
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+    index.clear();
+    stats.bytes = 0;
+  }
+
+  void setBudget(size_t budget) {
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.budget = budget;
+    while (!entries.empty() && stats.bytes > stats.budget) {
+      evictOldest();
+    }
+  }
+
+  LruCacheStats getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    LruCacheStats current = stats;
+    current.entries = entries.size();
+    return current;
+  }
+};
@@ -0,0 +1,127 @@
+#include "match-orientation.hpp"
+
+static const int rotateCodes[] = {-1, cv::ROTATE_90_CLOCKWISE, cv::ROTATE_180,
+                                  cv::ROTATE_90_COUNTERCLOCKWISE};
+
+void orientImage(const cv::Mat &image, cv::Mat &out, int orientation) {
+  int quarterTurns = orientation % 4;
+  bool mirror = orientation >= MatchOrientation_Mirror;
+
+  if (!mirror && !quarterTurns) {
+    out = image;
+  } else if (!quarterTurns) {
+    cv::flip(image, out, 1);
+  } else if (!mirror) {
+    cv::rotate(image, out, rotateCodes[quarterTurns]);
+  } else {
+    cv::Mat mirrored;
+    cv::flip(image, mirrored, 1);
+    cv::rotate(mirrored, out, rotateCodes[quarterTurns]);
+  }
+}
+
+void unorientImage(const cv::Mat &image, cv::Mat &out, int orientation) {
+  int quarterTurns = orientation % 4;
+  bool mirror = orientation >= MatchOrientation_Mirror;
+
+  if (!mirror && !quarterTurns) {
+    out = image;
+  } else if (!quarterTurns) {
+    cv::flip(image, out, 1);
+  } else if (!mirror) {
+    cv::rotate(image, out, rotateCodes[4 - quarterTurns]);
+  } else {
+    cv::Mat unrotated;
+    cv::rotate(image, unrotated, rotateCodes[4 - quarterTurns]);
+    cv::flip(unrotated, out, 1);
+  }
+}
+
+cv::Size orientedSize(cv::Size size, int orientation) {
+  if (orientation % 2) {
+    return {size.height, size.width};
+  }
+  return size;
+}
+
+cv::Point orientVector(cv::Point vector, int orientation) {
+  if (orientation >= MatchOrientation_Mirror) {
+    vector.x = -vector.x;
+  }
+
+  switch (orientation % 4) {
+  case 1:
+    return {-vector.y, vector.x};
+  case 2:
+    return {-vector.x, -vector.y};
+  case 3:
+    return {vector.y, -vector.x};
+  }
+  return vector;
+}
+
+cv::Size rotatedSize(cv::Size size, float angle) {
+  if (angle == 0) {
+    return size;
+  }
+
+  float radians = angle * CV_PI / 180;
+  float cosine = std::abs(std::cos(radians));
+  float sine = std::abs(std::sin(radians));
+  return {(int)std::ceil(size.width * cosine + size.height * sine),
+          (int)std::ceil(size.width * sine + size.height * cosine)};
+}
+
+// Same as cv::getRotationMatrix2D, which is anticlockwise with y pointing down
+cv::Point rotateVector(cv::Point vector, float angle) {
+  if (angle == 0) {
+    return vector;
+  }
+
+  float radians = angle * CV_PI / 180;
+  float cosine = std::cos(radians);
+  float sine = std::sin(radians);
+  return {(int)std::round(cosine * vector.x + sine * vector.y),
+          (int)std::round(-sine * vector.x + cosine * vector.y)};
+}
+
+cv::Mat rotationFor(cv::Size size, float angle) {
+  cv::Size bounds = rotatedSize(size, angle);
+  cv::Mat rotation = cv::getRotationMatrix2D(
+      cv::Point2f(size.width / 2.f, size.height / 2.f), angle, 1);
+  rotation.at<double>(0, 2) += (bounds.width - size.width) / 2.;
+  rotation.at<double>(1, 2) += (bounds.height - size.height) / 2.;
+  return rotation;
+}
+
+cv::Mat unrotateCrop(const cv::Mat &crop, float angle, cv::Size canvas) {
+  if (angle == 0) {
+    return crop;
+  }
+
+  cv::Size bounds = rotatedSize(canvas, angle);
+  float cropScale = (float)crop.cols / bounds.width;
+  cv::Size canvasPixels(std::round(canvas.width * cropScale),
+                        std::round(canvas.height * cropScale));
+
+  // Rotating the canvas back from the bounding box is the inverse of rotating
+  // it into the box
+  cv::Mat unrotation;
+  cv::invertAffineTransform(rotationFor(canvasPixels, angle), unrotation);
+
+  cv::Mat upright;
+  cv::warpAffine(crop, upright, unrotation, canvasPixels, cv::INTER_LINEAR,
+                 cv::BORDER_REPLICATE);
+  return upright;
+}
+
+int parseOrientationSet(const std::string &name) {
+  if (name == "upright") {
+    return MatchOrientationSet_Upright;
+  } else if (name == "rotations") {
+    return MatchOrientationSet_Rotations;
+  } else if (name == "all") {
+    return MatchOrientationSet_All;
+  }
+  throw std::runtime_error("Unknown orientations: " + name);
+}
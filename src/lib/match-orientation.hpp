@@ -0,0 +1,48 @@
+#pragma once
+
+#include "../precompiled.h"
+#include "../config.h"
+
+// Which way round an image matched: mirrored left to right first or not,
+// then turned clockwise by a number of quarter turns
+enum MatchOrientations {
+  MatchOrientation_Upright,
+  MatchOrientation_Rotate90,
+  MatchOrientation_Rotate180,
+  MatchOrientation_Rotate270,
+  MatchOrientation_Mirror,
+  MatchOrientation_MirrorRotate90,
+  MatchOrientation_MirrorRotate180,
+  MatchOrientation_MirrorRotate270,
+  MatchOrientation_Count
+};
+
+// Sets of orientations to search, one bit per orientation
+enum MatchOrientationSets {
+  MatchOrientationSet_Upright = 1 << MatchOrientation_Upright,
+  MatchOrientationSet_Rotations = 0x0f,
+  MatchOrientationSet_All = 0xff
+};
+
+// Turns an upright image the given way round. `out` is reused if it's the
+// right size already, or shares the image's pixels if it's upright
+void orientImage(const cv::Mat &image, cv::Mat &out, int orientation);
+// Turns an image the given way round back upright
+void unorientImage(const cv::Mat &image, cv::Mat &out, int orientation);
+// The size of an image once turned
+cv::Size orientedSize(cv::Size size, int orientation);
+// Where a vector in the upright image points once it's turned
+cv::Point orientVector(cv::Point vector, int orientation);
+
+// On top of the orientation, an image can be rotated by any angle, in degrees
+// anticlockwise. Rotating grows it to the bounding box of the rotated image
+cv::Size rotatedSize(cv::Size size, float angle);
+cv::Point rotateVector(cv::Point vector, float angle);
+// The affine transform rotating an image of the given size into its bounding
+// box
+cv::Mat rotationFor(cv::Size size, float angle);
+// Takes a crop of the bounding box back to the canvas it was rotated from,
+// which is `canvas` in size before being scaled up to the crop
+cv::Mat unrotateCrop(const cv::Mat &crop, float angle, cv::Size canvas);
+
+int parseOrientationSet(const std::string &name);
@@ -0,0 +1,30 @@
+#include "path-table.hpp"
+
+PathTable &PathTable::shared() {
+  static PathTable pathTable;
+  return pathTable;
+}
+
+int PathTable::intern(const std::string &path) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto it = ids.find(path);
+  if (it != ids.end()) {
+    return it->second;
+  }
+
+  int id = paths.size();
+  paths.push_back(path);
+  ids.emplace(paths.back(), id);
+  return id;
+}
+
+const std::string &PathTable::path(int id) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return paths.at(id);
+}
+
+int PathTable::size() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return paths.size();
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+#include "../precompiled.h"
+
+// Every image path the process has seen, each stored once and numbered, so
+// that the same path can be referred to from many places by its ID. Paths
+// are never removed, so references to them stay valid. Safe to share between
+// threads.
+class PathTable {
+  std::deque<std::string> paths;
+  std::unordered_map<std::string_view, int> ids;
+  mutable std::mutex mutex;
+
+public:
+  static PathTable &shared();
+
+  int intern(const std::string &path);
+  const std::string &path(int id) const;
+  int size() const;
+};
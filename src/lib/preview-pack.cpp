@@ -0,0 +1,160 @@
+#include "preview-pack.hpp"
+#include "image-cache.hpp"
+
+PreviewPack::PreviewPack(const std::string &dirPath) {
+  std::filesystem::path path{dirPath};
+  path.append(".previews");
+  packPath = path;
+}
+
+// One per directory for the whole process, so that they share an index
+std::shared_ptr<PreviewPack>
+PreviewPack::forDirectory(const std::string &dirPath) {
+  static std::mutex packsMutex;
+  static std::unordered_map<std::string, std::shared_ptr<PreviewPack>> packs;
+
+  std::string key = std::filesystem::path(dirPath).lexically_normal();
+  if (key.empty()) {
+    key = ".";
+  }
+
+  std::lock_guard<std::mutex> packsLock(packsMutex);
+  std::shared_ptr<PreviewPack> &pack = packs[key];
+  if (!pack) {
+    pack.reset(new PreviewPack(key));
+  }
+  return pack;
+}
+
+cv::Mat PreviewPack::makePreview(const cv::Mat &image) {
+  if (image.cols <= PREVIEW_WIDTH) {
+    return image;
+  }
+
+  cv::Mat preview;
+  int height = (double)image.rows / image.cols * PREVIEW_WIDTH;
+  cv::resize(image, preview, {PREVIEW_WIDTH, height}, 0, 0, cv::INTER_AREA);
+  return preview;
+}
+
+void PreviewPack::savePreview(const std::string &imagePath,
+                              const cv::Mat &image) {
+  std::filesystem::path path{imagePath};
+  forDirectory(path.parent_path())->add(path.filename(), makePreview(image));
+}
+
+// Empty if there's no preview for the image. Previews go through the image
+// cache, alongside the originals
+cv::Mat PreviewPack::loadPreview(const std::string &imagePath) {
+  return ImageCache::shared().get(imagePath + "#preview", [&]() {
+    std::filesystem::path path{imagePath};
+    return forDirectory(path.parent_path())->read(path.filename());
+  });
+}
+
+// Indexes anything added since last time, which might have been by another
+// process. Stops at a record that isn't completely written yet
+void PreviewPack::scan() {
+  std::ifstream packFile(packPath, std::ios::binary | std::ios::ate);
+  if (!packFile) {
+    return;
+  }
+
+  uint64_t fileSize = packFile.tellg();
+  packFile.seekg(indexedBytes);
+
+  while (indexedBytes < fileSize) {
+    uint32_t nameLength;
+    uint64_t size;
+    if (!packFile.read((char *)&nameLength, sizeof(nameLength)) ||
+        nameLength > 4096) {
+      break;
+    }
+
+    std::string fileName(nameLength, '\0');
+    if (!packFile.read(fileName.data(), nameLength) ||
+        !packFile.read((char *)&size, sizeof(size))) {
+      break;
+    }
+
+    uint64_t offset = indexedBytes + sizeof(nameLength) + nameLength +
+                      sizeof(size);
+    if (offset + size > fileSize) {
+      break;
+    }
+
+    index[fileName] = {offset, size};
+    indexedBytes = offset + size;
+    packFile.seekg(indexedBytes);
+  }
+}
+
+bool PreviewPack::has(const std::string &fileName) {
+  std::lock_guard<std::mutex> packLock(mutex);
+  if (!index.count(fileName)) {
+    scan();
+  }
+  return index.count(fileName);
+}
+
+// Replacing a preview appends a new one: the newest always wins
+void PreviewPack::add(const std::string &fileName, const cv::Mat &preview) {
+  std::vector<uchar> encoded;
+  cv::imencode(".jpg", preview, encoded,
+               {cv::IMWRITE_JPEG_QUALITY, PREVIEW_JPEG_QUALITY});
+
+  std::lock_guard<std::mutex> packLock(mutex);
+  scan();
+
+  // Cut off anything left half written, or the new record won't be found
+  std::error_code error;
+  if (std::filesystem::file_size(packPath, error) > indexedBytes && !error) {
+    std::filesystem::resize_file(packPath, indexedBytes);
+  }
+
+  std::ofstream packFile(packPath, std::ios::binary | std::ios::app);
+  if (!packFile) {
+    throw std::runtime_error("Failed to open previews file.");
+  }
+
+  uint32_t nameLength = fileName.size();
+  uint64_t size = encoded.size();
+  packFile.write((const char *)&nameLength, sizeof(nameLength));
+  packFile.write(fileName.data(), nameLength);
+  packFile.write((const char *)&size, sizeof(size));
+  packFile.write((const char *)encoded.data(), size);
+
+  if (!packFile) {
+    throw std::runtime_error("Failed to write previews file.");
+  }
+
+  uint64_t offset = indexedBytes + sizeof(nameLength) + nameLength +
+                    sizeof(size);
+  index[fileName] = {offset, size};
+  indexedBytes = offset + size;
+}
+
+cv::Mat PreviewPack::read(const std::string &fileName) {
+  std::pair<uint64_t, uint64_t> entry;
+  {
+    std::lock_guard<std::mutex> packLock(mutex);
+    if (!index.count(fileName)) {
+      scan();
+    }
+
+    auto it = index.find(fileName);
+    if (it == index.end()) {
+      return cv::Mat();
+    }
+    entry = it->second;
+  }
+
+  std::ifstream packFile(packPath, std::ios::binary);
+  std::vector<uchar> encoded(entry.second);
+  packFile.seekg(entry.first);
+  if (!packFile.read((char *)encoded.data(), encoded.size())) {
+    return cv::Mat();
+  }
+
+  return cv::imdecode(encoded, cv::IMREAD_COLOR);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
+
+#include "../precompiled.h"
+#include "../config.h"
+
+// Preview sized copies of the images in a directory, made when they're
+// processed so that interactive previews don't have to decode the originals.
+// They're JPEG encoded and appended one after another to a `.previews` file
+// in the same directory, each after its file name.
+class PreviewPack {
+  std::string packPath;
+  // File name to offset and size of the encoded preview
+  std::unordered_map<std::string, std::pair<uint64_t, uint64_t>> index;
+  uint64_t indexedBytes = 0;
+  std::mutex mutex;
+
+  PreviewPack(const std::string &dirPath);
+  void scan();
+
+public:
+  static std::shared_ptr<PreviewPack> forDirectory(const std::string &dirPath);
+
+  static cv::Mat makePreview(const cv::Mat &image);
+  static void savePreview(const std::string &imagePath, const cv::Mat &image);
+  static cv::Mat loadPreview(const std::string &imagePath);
+
+  bool has(const std::string &fileName);
+  void add(const std::string &fileName, const cv::Mat &preview);
+  cv::Mat read(const std::string &fileName);
+};
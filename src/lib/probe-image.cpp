@@ -0,0 +1,221 @@
+#include "probe-image.hpp"
+
+// Lets the parsers below run over an encoded buffer that's already in memory
+class MemoryStreamBuf : public std::streambuf {
+public:
+  MemoryStreamBuf(const uchar *data, size_t size) {
+    char *begin = (char *)data;
+    setg(begin, begin, begin + size);
+  }
+
+protected:
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                   std::ios_base::openmode which) override {
+    char *target = dir == std::ios_base::beg   ? eback() + off
+                   : dir == std::ios_base::cur ? gptr() + off
+                                               : egptr() + off;
+    if (target < eback() || target > egptr()) {
+      return pos_type(off_type(-1));
+    }
+    setg(eback(), target, egptr());
+    return pos_type(target - eback());
+  }
+
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+  }
+};
+
+static int readUint16(std::istream &file, bool littleEndian = false) {
+  int a = file.get();
+  int b = file.get();
+  return littleEndian ? (b << 8) | a : (a << 8) | b;
+}
+
+static uint32_t readUint32(std::istream &file, bool littleEndian = false) {
+  uint32_t a = readUint16(file, littleEndian);
+  uint32_t b = readUint16(file, littleEndian);
+  return littleEndian ? (b << 16) | a : (a << 16) | b;
+}
+
+// Reads the tags we care about from the first IFD of a TIFF structure -
+// either a TIFF file or the EXIF block in a JPEG. `base` is the position of
+// the byte order mark, which all offsets are relative to
+static bool readTiffIfd(std::istream &file, std::streamoff base,
+                        ImageProbe *probe) {
+  file.seekg(base);
+  int byteOrder = readUint16(file);
+  bool littleEndian;
+  if (byteOrder == 0x4949) {
+    littleEndian = true;
+  } else if (byteOrder == 0x4D4D) {
+    littleEndian = false;
+  } else {
+    return false;
+  }
+
+  if (readUint16(file, littleEndian) != 42) {
+    return false;
+  }
+
+  uint32_t ifdOffset = readUint32(file, littleEndian);
+  file.seekg(base + ifdOffset);
+  int entries = readUint16(file, littleEndian);
+
+  for (int i = 0; i < entries && file.good(); ++i) {
+    int tag = readUint16(file, littleEndian);
+    int type = readUint16(file, littleEndian);
+    readUint32(file, littleEndian); // Count
+    // SHORT values are left aligned in the four byte value field
+    uint32_t value = type == 3 ? readUint16(file, littleEndian)
+                               : readUint32(file, littleEndian);
+    if (type == 3) {
+      readUint16(file, littleEndian);
+    }
+
+    if (tag == 0x0100) {
+      probe->storedWidth = value;
+    } else if (tag == 0x0101) {
+      probe->storedHeight = value;
+    } else if (tag == 0x0112 && value >= 1 && value <= 8) {
+      probe->orientation = value;
+    }
+  }
+
+  return file.good();
+}
+
+static void probeJpeg(std::istream &file, ImageProbe *probe) {
+  file.seekg(2);
+
+  while (file.good()) {
+    if (file.get() != 0xFF) {
+      return;
+    }
+
+    int marker = file.get();
+    while (marker == 0xFF) {
+      marker = file.get();
+    }
+
+    // Standalone markers don't have a length
+    if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) {
+      continue;
+    }
+    // Hit the image data without seeing a frame header
+    if (marker == 0xD9 || marker == 0xDA || marker == EOF) {
+      return;
+    }
+
+    int length = readUint16(file);
+    if (length < 2) {
+      return;
+    }
+    std::streamoff segmentEnd = (std::streamoff)file.tellg() + length - 2;
+
+    bool isFrameHeader = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+                         marker != 0xC8 && marker != 0xCC;
+    if (isFrameHeader) {
+      file.get(); // Precision
+      probe->storedHeight = readUint16(file);
+      probe->storedWidth = readUint16(file);
+
+      // EXIF always comes before the frame header so we're done
+      if (file.good()) {
+        probe->format = ImageFormat_Jpeg;
+      }
+      return;
+    }
+
+    if (marker == 0xE1 && length >= 8) {
+      char exifHeader[6];
+      file.read(exifHeader, 6);
+      if (memcmp(exifHeader, "Exif\0\0", 6) == 0) {
+        // The EXIF dimensions aren't trustworthy, only keep the orientation
+        ImageProbe exif;
+        if (readTiffIfd(file, file.tellg(), &exif)) {
+          probe->orientation = exif.orientation;
+        }
+        file.clear();
+      }
+    }
+
+    file.seekg(segmentEnd);
+  }
+}
+
+static void probePng(std::istream &file, ImageProbe *probe) {
+  file.seekg(8);
+
+  readUint32(file); // Chunk length
+  char chunkType[4];
+  file.read(chunkType, 4);
+  if (memcmp(chunkType, "IHDR", 4) != 0) {
+    return;
+  }
+
+  probe->storedWidth = readUint32(file);
+  probe->storedHeight = readUint32(file);
+
+  if (file.good()) {
+    probe->format = ImageFormat_Png;
+  }
+}
+
+static void probeTiff(std::istream &file, ImageProbe *probe) {
+  if (readTiffIfd(file, 0, probe)) {
+    probe->format = ImageFormat_Tiff;
+  }
+}
+
+static ImageProbe probeStream(std::istream &file, uintmax_t fileSize) {
+  ImageProbe probe;
+  probe.fileSize = fileSize;
+
+  uchar magic[8] = {0};
+  file.read((char *)magic, 8);
+  if (!file.good()) {
+    return probe;
+  }
+
+  if (magic[0] == 0xFF && magic[1] == 0xD8) {
+    probeJpeg(file, &probe);
+  } else if (memcmp(magic, "\x89PNG\r\n\x1A\n", 8) == 0) {
+    probePng(file, &probe);
+  } else if (memcmp(magic, "II*\0", 4) == 0 || memcmp(magic, "MM\0*", 4) == 0) {
+    probeTiff(file, &probe);
+  }
+
+  return probe;
+}
+
+ImageProbe probeImage(const std::string &path) {
+  std::error_code error;
+  uintmax_t fileSize = std::filesystem::file_size(path, error);
+
+  std::ifstream file(path, std::ios::binary);
+  if (!file || error) {
+    return ImageProbe();
+  }
+
+  return probeStream(file, fileSize);
+}
+
+ImageProbe probeImage(const uchar *data, size_t size) {
+  MemoryStreamBuf buffer(data, size);
+  std::istream stream(&buffer);
+  return probeStream(stream, size);
+}
+
+bool ImageProbe::valid() const {
+  return format != ImageFormat_Unknown && storedWidth > 0 && storedHeight > 0;
+}
+
+// Orientations 5-8 involve a transpose
+bool ImageProbe::rotated() const { return orientation >= 5; }
+
+int ImageProbe::width() const { return rotated() ? storedHeight : storedWidth; }
+
+int ImageProbe::height() const {
+  return rotated() ? storedWidth : storedHeight;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+
+#include "../precompiled.h"
+
+enum ImageFormats {
+  ImageFormat_Unknown,
+  ImageFormat_Jpeg,
+  ImageFormat_Png,
+  ImageFormat_Tiff
+};
+
+// Everything we can learn about an image from its headers, without decoding
+// any pixels
+struct ImageProbe {
+  int format = ImageFormat_Unknown;
+  // As stored in the file, before the EXIF orientation is applied
+  int storedWidth = 0, storedHeight = 0;
+  int orientation = 1;
+  uintmax_t fileSize = 0;
+
+  bool valid() const;
+  bool rotated() const;
+  // Dimensions after the orientation has been applied: this is what
+  // cv::imread returns
+  int width() const;
+  int height() const;
+};
+
+ImageProbe probeImage(const std::string &path);
+ImageProbe probeImage(const uchar *data, size_t size);
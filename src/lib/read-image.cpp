@@ -0,0 +1,84 @@
+#include "read-image.hpp"
+
+// Picks the largest reduction (DCT scaling for JPEGs) that still leaves the
+// decoded image at least minWidth wide. Width is after orientation is applied
+int reducedReadFlag(int width, int minWidth, int *reduction) {
+  const int factors[] = {8, 4, 2};
+  const int flags[] = {cv::IMREAD_REDUCED_COLOR_8, cv::IMREAD_REDUCED_COLOR_4,
+                       cv::IMREAD_REDUCED_COLOR_2};
+
+  for (int i = 0; i < 3; ++i) {
+    if (width / factors[i] >= minWidth) {
+      if (reduction) {
+        *reduction = factors[i];
+      }
+      return flags[i];
+    }
+  }
+
+  if (reduction) {
+    *reduction = 1;
+  }
+  return cv::IMREAD_COLOR;
+}
+
+ReducedImage readImageReduced(const std::string &path, int minWidth) {
+  return readImageReduced(path, probeImage(path), minWidth);
+}
+
+ReducedImage readImageReduced(const std::string &path,
+                              const ImageProbe &probe, int minWidth) {
+  return decodeImageReduced(BulkReader::readFile(path), probe, minWidth);
+}
+
+ReducedImage decodeImageReduced(const std::vector<uchar> &buffer,
+                                const ImageProbe &probe, int minWidth) {
+  auto start = std::chrono::high_resolution_clock::now();
+
+  ReducedImage reduced;
+  int flag = cv::IMREAD_COLOR;
+
+  // Other formats would be decoded in full and then resized, which doesn't
+  // save anything
+  if (probe.format == ImageFormat_Jpeg) {
+    flag = reducedReadFlag(probe.width(), minWidth, &reduced.reduction);
+  }
+
+  if (buffer.empty()) {
+    return reduced;
+  }
+
+  reduced.image = cv::imdecode(buffer, flag);
+
+  if (reduced.image.empty()) {
+    return reduced;
+  }
+
+  if (reduced.reduction != 1 && probe.valid()) {
+    reduced.width = probe.width();
+    reduced.height = probe.height();
+  } else {
+    reduced.width = reduced.image.cols;
+    reduced.height = reduced.image.rows;
+  }
+
+  auto finish = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<float> elapsed = finish - start;
+  reduced.decodeSeconds = elapsed.count();
+
+  return reduced;
+}
+
+void DecodeStats::add(const ReducedImage &reduced) {
+  images++;
+  seconds += reduced.decodeSeconds;
+  decodedBytes += reduced.image.total() * reduced.image.elemSize();
+  fullBytes += (size_t)reduced.width * reduced.height * 3;
+}
+
+std::ostream &operator<<(std::ostream &os, const DecodeStats &stats) {
+  os << "Decoded " << stats.images << " images in " << stats.seconds << "s ("
+     << stats.decodedBytes / 1048576.f << "MB decoded, "
+     << stats.fullBytes / 1048576.f << "MB at full resolution)";
+  return os;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "../precompiled.h"
+#include "../config.h"
+
+#include "bulk-reader.hpp"
+#include "probe-image.hpp"
+
+struct ReducedImage {
+  cv::Mat image;
+  // Dimensions of the image at full resolution, not of `image`
+  int width = 0, height = 0;
+  int reduction = 1;
+  float decodeSeconds = 0;
+};
+
+struct DecodeStats {
+  int images = 0;
+  float seconds = 0;
+  size_t decodedBytes = 0, fullBytes = 0;
+
+  void add(const ReducedImage &reduced);
+};
+
+int reducedReadFlag(int width, int minWidth, int *reduction = nullptr);
+ReducedImage readImageReduced(const std::string &path,
+                              int minWidth = EDGE_DETECTION_WIDTH);
+ReducedImage readImageReduced(const std::string &path, const ImageProbe &probe,
+                              int minWidth = EDGE_DETECTION_WIDTH);
+ReducedImage decodeImageReduced(const std::vector<uchar> &buffer,
+                                const ImageProbe &probe,
+                                int minWidth = EDGE_DETECTION_WIDTH);
+
+std::ostream& operator<<(std::ostream& os, const DecodeStats& stats);
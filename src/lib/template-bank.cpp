@@ -0,0 +1,118 @@
+#include "template-bank.hpp"
+
+// The same for every template of a size, as the shuffle is always seeded the
+// same way
+std::shared_ptr<const std::vector<uint32_t>> shuffledPixels(cv::Size size) {
+  auto shuffled = std::make_shared<std::vector<uint32_t>>(size.area());
+  std::iota(shuffled->begin(), shuffled->end(), 0);
+  std::shuffle(shuffled->begin(), shuffled->end(), std::mt19937(1));
+  return shuffled;
+}
+
+// Angles go from -angleRange to angleRange in steps, always including 0. If
+// sequential, each view gets its sample order too
+TemplateBank::TemplateBank(const cv::Mat &templateImage, int contextOffsetX,
+                           int contextOffsetY, int orientations,
+                           float angleRange, float angleStep,
+                           bool sequential) {
+  int stepsEitherSide = angleStep > 0 ? std::floor(angleRange / angleStep) : 0;
+  for (int i = -stepsEitherSide; i <= stepsEitherSide; ++i) {
+    _angles.push_back(i * angleStep);
+  }
+
+  cv::Mat shifted = cv::Mat::zeros(templateImage.size(), templateImage.type());
+  int x1 = contextOffsetX < 0 ? 0 : contextOffsetX;
+  int rectWidth = templateImage.cols - std::abs(contextOffsetX);
+  int y1 = contextOffsetY < 0 ? 0 : contextOffsetY;
+  int rectHeight = templateImage.rows - std::abs(contextOffsetY);
+  templateImage(cv::Rect(x1, y1, rectWidth, rectHeight))
+      .copyTo(shifted(cv::Rect(x1 - contextOffsetX, y1 - contextOffsetY,
+                               rectWidth, rectHeight)));
+
+  for (int o = 0; o < MatchOrientation_Count; ++o) {
+    if (!(orientations & (1 << o))) {
+      continue;
+    }
+    _orientations.push_back(o);
+
+    cv::Mat oriented;
+    orientImage(shifted, oriented, o);
+    cv::Size canvas =
+        orientedSize(cv::Size(CANVAS_WIDTH, CANVAS_HEIGHT), o);
+    cv::Point contextOffset =
+        orientVector(cv::Point(contextOffsetX, contextOffsetY), o);
+
+    for (float angle : _angles) {
+      TemplateView view;
+      view.orientation = o;
+      view.angle = angle;
+
+      cv::Size bounds = rotatedSize(canvas, angle);
+      view.canvasWidth = bounds.width;
+      view.canvasHeight = bounds.height;
+
+      cv::Point rotatedOffset = rotateVector(contextOffset, angle);
+      view.contextOffsetX = rotatedOffset.x;
+      view.contextOffsetY = rotatedOffset.y;
+
+      if (angle == 0) {
+        view.image = oriented;
+      } else {
+        // Nearest neighbour keeps edges on or off, and anything outside the
+        // canvas is marked so it isn't scored
+        cv::Mat rotation = rotationFor(oriented.size(), angle);
+        cv::Size imageBounds = rotatedSize(oriented.size(), angle);
+
+        cv::Mat rotated, inside;
+        cv::warpAffine(oriented, rotated, rotation, imageBounds,
+                       cv::INTER_NEAREST, cv::BORDER_CONSTANT, 0);
+        cv::warpAffine(cv::Mat(oriented.size(), CV_8U, cv::Scalar(255)),
+                       inside, rotation, imageBounds, cv::INTER_NEAREST,
+                       cv::BORDER_CONSTANT, 0);
+
+        view.image = cv::Mat(imageBounds, CV_8U,
+                             cv::Scalar(MATCH_TEMPLATE_OUTSIDE));
+        view.image.setTo(0, inside);
+        view.image.setTo(255, rotated & inside);
+        view.masked = true;
+      }
+
+      if (sequential) {
+        view.sampleOrder = shuffledPixels(view.image.size());
+      }
+
+      _views.push_back(std::move(view));
+    }
+  }
+}
+
+const std::vector<int> &TemplateBank::orientations() const {
+  return _orientations;
+}
+
+int TemplateBank::angleCount() const { return _angles.size(); }
+
+float TemplateBank::angle(int angleIndex) const {
+  return _angles.at(angleIndex);
+}
+
+// The nearest angle in the bank
+int TemplateBank::angleIndex(float angle) const {
+  int nearest = 0;
+  for (int i = 1; i < _angles.size(); ++i) {
+    if (std::abs(_angles[i] - angle) < std::abs(_angles[nearest] - angle)) {
+      nearest = i;
+    }
+  }
+  return nearest;
+}
+
+// The orientation must be one the bank was made with
+const TemplateView &TemplateBank::view(int orientation, int angleIndex) const {
+  auto it = std::find(_orientations.begin(), _orientations.end(), orientation);
+  if (it == _orientations.end()) {
+    throw std::runtime_error("Orientation not in template bank.");
+  }
+  return _views.at((it - _orientations.begin()) * _angles.size() +
+                   angleIndex);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <numeric>
+#include <random>
+
+#include "../precompiled.h"
+#include "../config.h"
+
+#include "match-orientation.hpp"
+
+// The template turned one way round, ready to match
+struct TemplateView {
+  cv::Mat image;
+  int orientation = MatchOrientation_Upright;
+  float angle = 0;
+  // The canvas once turned, or its bounding box once rotated, and where the
+  // context offset points once turned
+  int canvasWidth = CANVAS_WIDTH, canvasHeight = CANVAS_HEIGHT;
+  int contextOffsetX = 0, contextOffsetY = 0;
+  // Pixels outside the rotated canvas are MATCH_TEMPLATE_OUTSIDE
+  bool masked = false;
+  // Every pixel of the image shuffled, for sequential matching. Only made if
+  // it's going to be used
+  std::shared_ptr<const std::vector<uint32_t>> sampleOrder;
+};
+
+std::shared_ptr<const std::vector<uint32_t>> shuffledPixels(cv::Size size);
+
+// The template shifted by the context offset, then turned to each orientation
+// and rotated to each angle, made once per query and shared by every thread
+// and image
+class TemplateBank {
+  std::vector<int> _orientations;
+  std::vector<float> _angles;
+  // By orientation, then angle
+  std::vector<TemplateView> _views;
+
+public:
+  TemplateBank(const cv::Mat &templateImage, int contextOffsetX,
+               int contextOffsetY, int orientations, float angleRange,
+               float angleStep = MATCH_ANGLE_STEP, bool sequential = false);
+
+  const std::vector<int> &orientations() const;
+  int angleCount() const;
+  float angle(int angleIndex) const;
+  int angleIndex(float angle) const;
+  const TemplateView &view(int orientation, int angleIndex) const;
+};
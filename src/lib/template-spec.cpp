@@ -0,0 +1,129 @@
+#include <fstream>
+
+#include "template-spec.hpp"
+
+cv::Mat drawTemplate(const TemplateSpec &spec) {
+  cv::Mat canvas = cv::Mat::zeros(CANVAS_HEIGHT, CANVAS_WIDTH, CV_8UC3);
+
+  cv::Point center(CANVAS_WIDTH / 2 + spec.offsetX,
+                   CANVAS_HEIGHT / 2 + spec.offsetY);
+  if (spec.shape == TemplateShape_Rect) {
+    cv::Point diff(spec.width / 2, spec.height / 2);
+    cv::rectangle(canvas, center - diff, center + diff, cv::Scalar(0, 0, 255),
+                  spec.lineWidth);
+  } else if (spec.shape == TemplateShape_Circle) {
+    cv::circle(canvas, center, spec.width / 2, cv::Scalar(0, 0, 255),
+               spec.lineWidth);
+  } else if (spec.shape == TemplateShape_Path) {
+    vectorTemplateFor(spec).draw(canvas, cv::Scalar(0, 0, 255),
+                                 spec.lineWidth);
+  }
+
+  return canvas;
+}
+
+cv::Mat drawTemplateGrey(const TemplateSpec &spec) {
+  cv::Mat greyCanvas;
+  cv::cvtColor(drawTemplate(spec), greyCanvas, cv::COLOR_BGR2GRAY);
+  return greyCanvas;
+}
+
+// The same shapes as drawTemplate draws
+VectorTemplate vectorTemplateFor(const TemplateSpec &spec) {
+  VectorTemplate shapes;
+
+  cv::Point2f center(CANVAS_WIDTH / 2 + spec.offsetX,
+                     CANVAS_HEIGHT / 2 + spec.offsetY);
+  if (spec.shape == TemplateShape_Rect) {
+    cv::Point2f diff(spec.width / 2, spec.height / 2);
+    shapes.addRect(center - diff, center + diff);
+  } else if (spec.shape == TemplateShape_Circle) {
+    shapes.addCircle(center, spec.width / 2);
+  } else if (spec.shape == TemplateShape_Path) {
+    shapes.addPath(spec.path, cv::Point2f(spec.offsetX, spec.offsetY));
+  }
+
+  return shapes;
+}
+
+// One frame per line, as space separated key=value pairs, e.g.
+//
+//   shape=rect width=48 height=550 x=0 y=0
+//
+// Anything not given is the same as the line before, so a line can just
+// change what moves. Also takes scale-step, x-step, y-step, min-scale,
+// max-offset, white-bias and line-width. shape=path takes SVG path data
+// without spaces, like path=M10,10L290,10L150,190Z, and vector=1 matches
+// along the outline. Blank lines and lines starting with # are skipped
+std::vector<TemplateSpec> readTemplateSpecs(const std::string &path) {
+  std::ifstream specFile(path);
+  if (!specFile) {
+    throw std::runtime_error("Failed to open template spec file.");
+  }
+
+  std::vector<TemplateSpec> specs;
+  TemplateSpec spec;
+
+  std::string line;
+  int lineNumber = 0;
+  while (std::getline(specFile, line)) {
+    lineNumber++;
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+
+    std::stringstream lineStream(line);
+    std::string field;
+    while (lineStream >> field) {
+      size_t equals = field.find('=');
+      std::string key = field.substr(0, equals);
+      std::string value =
+          equals == std::string::npos ? "" : field.substr(equals + 1);
+
+      try {
+        if (key == "shape" && value == "rect") {
+          spec.shape = TemplateShape_Rect;
+        } else if (key == "shape" && value == "circle") {
+          spec.shape = TemplateShape_Circle;
+        } else if (key == "shape" && value == "path") {
+          spec.shape = TemplateShape_Path;
+        } else if (key == "path") {
+          spec.path = value;
+        } else if (key == "vector") {
+          spec.vector = std::stoi(value);
+        } else if (key == "width") {
+          spec.width = std::stoi(value);
+        } else if (key == "height") {
+          spec.height = std::stoi(value);
+        } else if (key == "line-width") {
+          spec.lineWidth = std::stoi(value);
+        } else if (key == "x") {
+          spec.offsetX = std::stoi(value);
+        } else if (key == "y") {
+          spec.offsetY = std::stoi(value);
+        } else if (key == "scale-step") {
+          spec.offsetScaleStep = std::stof(value);
+        } else if (key == "x-step") {
+          spec.offsetXStep = std::stoi(value);
+        } else if (key == "y-step") {
+          spec.offsetYStep = std::stoi(value);
+        } else if (key == "min-scale") {
+          spec.minOffsetScale = std::stof(value);
+        } else if (key == "max-offset") {
+          spec.maxOffset = std::stoi(value);
+        } else if (key == "white-bias") {
+          spec.whiteBias = std::stof(value);
+        } else {
+          throw std::invalid_argument(key);
+        }
+      } catch (const std::logic_error &) {
+        throw std::runtime_error("Invalid template spec on line " +
+                                 std::to_string(lineNumber) + ": " + field);
+      }
+    }
+
+    specs.push_back(spec);
+  }
+
+  return specs;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "../precompiled.h"
+#include "../config.h"
+
+#include "vector-template.hpp"
+
+enum TemplateShapes {
+  TemplateShape_Rect,
+  TemplateShape_Circle,
+  TemplateShape_Path
+};
+
+// A template to match against, and how to search for it
+struct TemplateSpec {
+  int shape = TemplateShape_Rect;
+  int width = 48;
+  int height = 550;
+  // Algorithm is flawed: it'll probably zoom all the way in if lineWidth > 1
+  int lineWidth = 1;
+  int offsetX = 0;
+  int offsetY = 0;
+  // SVG path data for TemplateShape_Path, moved by the offset
+  std::string path;
+  // Match along the shape's outline rather than pixel by pixel
+  bool vector = false;
+
+  float offsetScaleStep = MATCH_OFFSET_SCALE_STEP;
+  int offsetXStep = MATCH_OFFSET_X_STEP;
+  int offsetYStep = MATCH_OFFSET_Y_STEP;
+  float minOffsetScale = MATCH_MIN_OFFSET_SCALE;
+  int maxOffset = MATCH_MAX_OFFSET;
+  float whiteBias = MATCH_WHITE_BIAS;
+};
+
+// Draws the template in red on a black canvas
+cv::Mat drawTemplate(const TemplateSpec &spec);
+cv::Mat drawTemplateGrey(const TemplateSpec &spec);
+VectorTemplate vectorTemplateFor(const TemplateSpec &spec);
+
+std::vector<TemplateSpec> readTemplateSpecs(const std::string &path);
@@ -0,0 +1,237 @@
+#include "vector-template.hpp"
+
+void VectorTemplate::addPolyline(std::vector<cv::Point2f> points,
+                                 bool closed) {
+  if (points.empty()) {
+    return;
+  }
+  if (closed && points.front() != points.back()) {
+    points.push_back(points.front());
+  }
+  _polylines.push_back(std::move(points));
+}
+
+void VectorTemplate::addRect(cv::Point2f topLeft, cv::Point2f bottomRight) {
+  addPolyline({topLeft,
+               {bottomRight.x, topLeft.y},
+               bottomRight,
+               {topLeft.x, bottomRight.y}},
+              true);
+}
+
+// As a polygon with sides no longer than a pixel
+void VectorTemplate::addCircle(cv::Point2f centre, float radius) {
+  int sides = std::max((int)std::ceil(2 * CV_PI * radius), 8);
+
+  std::vector<cv::Point2f> points;
+  for (int i = 0; i < sides; ++i) {
+    float theta = 2 * CV_PI * i / sides;
+    points.emplace_back(centre.x + radius * std::cos(theta),
+                        centre.y + radius * std::sin(theta));
+  }
+  addPolyline(std::move(points), true);
+}
+
+// A subset of SVG path data: M, L, H, V, C, Q and Z, and their relative
+// lowercase forms. Numbers are separated by commas or spaces. Curves are
+// flattened into lines no longer than a pixel
+void VectorTemplate::addPath(const std::string &path, cv::Point2f offset) {
+  size_t pos = 0;
+
+  auto skipSeparators = [&]() {
+    while (pos < path.size() && (path[pos] == ',' || std::isspace(path[pos]))) {
+      pos++;
+    }
+  };
+  auto hasNumber = [&]() {
+    skipSeparators();
+    return pos < path.size() &&
+           (std::isdigit(path[pos]) || path[pos] == '-' || path[pos] == '+' ||
+            path[pos] == '.');
+  };
+  auto readNumber = [&]() {
+    if (!hasNumber()) {
+      throw std::runtime_error("Invalid path: expected a number at " +
+                               std::to_string(pos));
+    }
+    size_t length;
+    float number = std::stof(path.substr(pos), &length);
+    pos += length;
+    return number;
+  };
+
+  std::vector<cv::Point2f> points;
+  cv::Point2f current = offset;
+  cv::Point2f start = offset;
+
+  auto finish = [&](bool closed) {
+    if (points.size() > 1) {
+      addPolyline(points, closed);
+    }
+    points.clear();
+  };
+
+  auto curveTo = [&](const std::vector<cv::Point2f> &control) {
+    float length = cv::norm(control.front() - current);
+    for (size_t i = 1; i < control.size(); ++i) {
+      length += cv::norm(control[i] - control[i - 1]);
+    }
+    int segments = std::max((int)std::ceil(length), 1);
+
+    // De Casteljau from the current point through the control points
+    for (int i = 1; i <= segments; ++i) {
+      float t = (float)i / segments;
+      std::vector<cv::Point2f> level = {current};
+      level.insert(level.end(), control.begin(), control.end());
+      while (level.size() > 1) {
+        for (size_t j = 0; j + 1 < level.size(); ++j) {
+          level[j] = level[j] * (1 - t) + level[j + 1] * t;
+        }
+        level.pop_back();
+      }
+      points.push_back(level[0]);
+    }
+    current = control.back();
+  };
+
+  char command = 0;
+  while (true) {
+    skipSeparators();
+    if (pos >= path.size()) {
+      break;
+    }
+
+    // Numbers without a command repeat the last one, except after a move,
+    // where they're lines
+    if (std::isalpha(path[pos])) {
+      command = path[pos++];
+    } else if (command == 'M') {
+      command = 'L';
+    } else if (command == 'm') {
+      command = 'l';
+    } else if (!command) {
+      throw std::runtime_error("Invalid path: expected a command");
+    }
+
+    bool relative = std::islower(command);
+    cv::Point2f base = relative ? current : offset;
+
+    // Lines and curves carry on from the current point, even after a close
+    int upper = std::toupper(command);
+    if (upper != 'M' && upper != 'Z' && points.empty()) {
+      points.push_back(current);
+    }
+
+    switch (upper) {
+    case 'M': {
+      finish(false);
+      float x = readNumber();
+      current = base + cv::Point2f(x, readNumber());
+      start = current;
+      points.push_back(current);
+      break;
+    }
+    case 'L': {
+      float x = readNumber();
+      current = base + cv::Point2f(x, readNumber());
+      points.push_back(current);
+      break;
+    }
+    case 'H':
+      current.x = (relative ? current.x : offset.x) + readNumber();
+      points.push_back(current);
+      break;
+    case 'V':
+      current.y = (relative ? current.y : offset.y) + readNumber();
+      points.push_back(current);
+      break;
+    case 'C':
+    case 'Q': {
+      int controlCount = upper == 'C' ? 3 : 2;
+      std::vector<cv::Point2f> control;
+      for (int i = 0; i < controlCount; ++i) {
+        float x = readNumber();
+        control.push_back(base + cv::Point2f(x, readNumber()));
+      }
+      curveTo(control);
+      break;
+    }
+    case 'Z':
+      finish(true);
+      current = start;
+      command = 0;
+      break;
+    default:
+      throw std::runtime_error(std::string("Invalid path: unsupported command ") +
+                               command);
+    }
+  }
+
+  finish(false);
+}
+
+bool VectorTemplate::empty() const { return _polylines.empty(); }
+
+float VectorTemplate::length() const {
+  float total = 0;
+  for (const std::vector<cv::Point2f> &polyline : _polylines) {
+    for (size_t i = 1; i < polyline.size(); ++i) {
+      total += cv::norm(polyline[i] - polyline[i - 1]);
+    }
+  }
+  return total;
+}
+
+// Replaces `points` with points along every shape, no more than `spacing`
+// apart, in order along each
+void VectorTemplate::outline(float spacing,
+                             std::vector<cv::Point2f> *points) const {
+  points->clear();
+
+  for (const std::vector<cv::Point2f> &polyline : _polylines) {
+    points->push_back(polyline.front());
+
+    for (size_t i = 1; i < polyline.size(); ++i) {
+      cv::Point2f from = polyline[i - 1];
+      cv::Point2f to = polyline[i];
+      int steps = std::max((int)std::ceil(cv::norm(to - from) / spacing), 1);
+
+      for (int step = 1; step <= steps; ++step) {
+        points->push_back(from + (to - from) * ((float)step / steps));
+      }
+    }
+  }
+}
+
+// Points along the outline moved by the context offset like the template's
+// pixels would be, dropping the ones that end up off it. The same for every
+// image, so made once per query
+std::shared_ptr<const std::vector<cv::Point2f>>
+VectorTemplate::placedOutline(int contextOffsetX, int contextOffsetY,
+                              cv::Size templateSize) const {
+  auto points = std::make_shared<std::vector<cv::Point2f>>();
+  outline(MATCH_OUTLINE_SPACING, points.get());
+
+  points->erase(std::remove_if(points->begin(), points->end(),
+                               [&](cv::Point2f &point) {
+                                 point.x -= contextOffsetX;
+                                 point.y -= contextOffsetY;
+                                 return point.x < 0 || point.y < 0 ||
+                                        point.x >= templateSize.width ||
+                                        point.y >= templateSize.height;
+                               }),
+                points->end());
+  return points;
+}
+
+void VectorTemplate::draw(cv::Mat &canvas, const cv::Scalar &colour,
+                          int lineWidth) const {
+  for (const std::vector<cv::Point2f> &polyline : _polylines) {
+    std::vector<cv::Point> rounded;
+    for (const cv::Point2f &point : polyline) {
+      rounded.emplace_back(std::round(point.x), std::round(point.y));
+    }
+    cv::polylines(canvas, std::vector<std::vector<cv::Point>>{rounded}, false,
+                  colour, lineWidth);
+  }
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "../precompiled.h"
+#include "../config.h"
+
+// A template made of shapes rather than pixels, in canvas coordinates.
+// Matching samples points along its outline instead of testing every pixel of
+// the canvas, so costs as much as the outline is long
+class VectorTemplate {
+  // Closed shapes end with the point they started at
+  std::vector<std::vector<cv::Point2f>> _polylines;
+
+public:
+  void addPolyline(std::vector<cv::Point2f> points, bool closed);
+  void addRect(cv::Point2f topLeft, cv::Point2f bottomRight);
+  void addCircle(cv::Point2f centre, float radius);
+  void addPath(const std::string &path, cv::Point2f offset = {0, 0});
+
+  bool empty() const;
+  float length() const;
+  void outline(float spacing, std::vector<cv::Point2f> *points) const;
+  std::shared_ptr<const std::vector<cv::Point2f>>
+  placedOutline(int contextOffsetX, int contextOffsetY,
+                cv::Size templateSize) const;
+  void draw(cv::Mat &canvas, const cv::Scalar &colour, int lineWidth) const;
+};
@@ -3,18 +3,155 @@
 #include "config.h"
 
 #include "lib/detect-edge.hpp"
+#include "lib/directory-watcher.hpp"
 #include "lib/edged-image.hpp"
 #include "lib/frame-collection.hpp"
 #include "lib/image-list.hpp"
 #include "lib/mat-to-texture.hpp"
+#include "lib/template-spec.hpp"
 #include "lib/window.hpp"
 
-enum TemplateShapes { TemplateShape_Rect, TemplateShape_Circle };
+// Matches a frame for each template spec without opening a window, then
+// assigns images to them and saves the collection
+static void runBatch(ImageList &sourceImages, const std::string &specPath,
+                     const std::string &name, const MatchOptions &options) {
+  std::vector<TemplateSpec> specs = readTemplateSpecs(specPath);
+  for (const TemplateSpec &spec : specs) {
+    if (spec.vector && !canMatchOutline(options)) {
+      throw std::runtime_error("vector=1 can't be used with --orientations "
+                               "or --angles.");
+    }
+  }
+  std::cout << "Matching " << specs.size() << " frames…\n";
+
+  auto batchStart = std::chrono::high_resolution_clock::now();
+
+  FrameCollection frames;
+  float slowestFrame = 0;
+
+  for (int i = 0; i < specs.size(); ++i) {
+    const TemplateSpec &spec = specs[i];
+    auto frameStart = std::chrono::high_resolution_clock::now();
+
+    ImageMatch bestMatch;
+    EdgedImage *bestMatchImage = nullptr;
+    sourceImages.provideMatchContext(spec.offsetX, spec.offsetY);
+    sourceImages.provideMatchOptions(options);
+    sourceImages.provideVectorTemplate(
+        spec.vector ? std::make_shared<VectorTemplate>(vectorTemplateFor(spec))
+                    : nullptr);
+    sourceImages.matchTo(drawTemplateGrey(spec), &bestMatch, &bestMatchImage,
+                         spec.offsetScaleStep, spec.offsetXStep,
+                         spec.offsetYStep, spec.minOffsetScale,
+                         spec.maxOffset, spec.whiteBias);
+    frames.addFrame(sourceImages);
+
+    auto frameFinish = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<float> frameElapsed = frameFinish - frameStart;
+    slowestFrame = std::max(slowestFrame, frameElapsed.count());
+
+    std::cout << "Frame " << i << ": " << bestMatch.percentage * 100
+              << "% best match in " << frameElapsed.count() << "s\n";
+  }
+
+  auto matchFinish = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<float> matchElapsed = matchFinish - batchStart;
+
+  std::cout << "Assigned images: " << frames.assignment() << '\n';
+  frames.save(name);
+
+  auto batchFinish = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<float> batchElapsed = batchFinish - batchStart;
+
+  std::cout << "Matched " << specs.size() << " frames in "
+            << matchElapsed.count() << "s ("
+            << matchElapsed.count() / std::max((int)specs.size(), 1)
+            << "s avg, " << slowestFrame << "s slowest)\n"
+            << "Built and saved " << name << " in " << batchElapsed.count()
+            << "s\n";
+
+  if (options.warmStart) {
+    auto [kept, missed] = EdgedImage::warmStartCounts();
+    std::cout << "Warm starts: " << kept << " kept, " << missed
+              << " searched in full\n";
+  }
+  if (options.refine) {
+    auto [evaluations, improved] = EdgedImage::refineCounts();
+    std::cout << "Refining: " << evaluations << " evaluations, improved "
+              << improved << " matches\n";
+  }
+  if (options.angleRange > 0) {
+    auto [searched, views] = EdgedImage::angleCounts();
+    std::cout << "Angles: searched " << searched << " of " << views << "\n";
+  }
+  if (options.sequential) {
+    SequentialStats stats = EdgedImage::sequentialStats();
+    std::cout << "Sequential screening: rejected " << stats.rejections
+              << " of " << stats.placements << " placements, "
+              << (float)stats.samples / std::max(stats.placements, (size_t)1)
+              << " samples avg";
+    if (options.auditSequential) {
+      std::cout << ", " << stats.misses << " wrongly";
+    }
+    std::cout << "\n";
+  }
+}
 
 int main(int argc, const char *argv[]) {
   auto readStart = std::chrono::high_resolution_clock::now();
 
-  ImageList sourceImages = ImageList(argv[1]);
+  std::vector<std::string> dirPaths;
+  bool recursive = false;
+  std::string batchPath;
+  std::string batchName;
+  MatchOptions matchOptions;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--recursive") == 0 || strcmp(argv[i], "-r") == 0) {
+      recursive = true;
+    } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+      batchPath = argv[++i];
+    } else if (strcmp(argv[i], "--name") == 0 && i + 1 < argc) {
+      batchName = argv[++i];
+    } else if (strcmp(argv[i], "--warm-start") == 0) {
+      matchOptions.warmStart = true;
+    } else if (strcmp(argv[i], "--refine") == 0) {
+      matchOptions.refine = true;
+    } else if (strcmp(argv[i], "--orientations") == 0 && i + 1 < argc) {
+      matchOptions.orientations = parseOrientationSet(argv[++i]);
+    } else if (strcmp(argv[i], "--angles") == 0 && i + 1 < argc) {
+      matchOptions.angleRange = std::stof(argv[++i]);
+    } else if (strcmp(argv[i], "--angle-step") == 0 && i + 1 < argc) {
+      matchOptions.angleStep = std::stof(argv[++i]);
+    } else if (strcmp(argv[i], "--sequential") == 0) {
+      matchOptions.sequential = true;
+    } else if (strcmp(argv[i], "--audit-sequential") == 0) {
+      matchOptions.sequential = true;
+      matchOptions.auditSequential = true;
+    } else if (strcmp(argv[i], "--error-rate") == 0 && i + 1 < argc) {
+      matchOptions.errorRate = std::stof(argv[++i]);
+    } else {
+      dirPaths.push_back(argv[i]);
+    }
+  }
+
+  if (dirPaths.empty()) {
+    std::cerr << "No directory specified, exiting\n";
+    exit(1);
+  }
+
+  if (!batchPath.empty() && batchName.empty()) {
+    std::cerr << "--batch needs a collection --name, exiting\n";
+    exit(1);
+  }
+
+  ImageList sourceImages = ImageList(dirPaths, recursive, MATCH_OUT_OF_CORE);
+  if (MATCH_OUT_OF_CORE) {
+    // Edges stay on disk
+  } else if (EDGE_RUNS_IN_MEMORY) {
+    sourceImages.useRuns();
+  } else if (EDGE_ARENA_ENABLED) {
+    sourceImages.useArena();
+  }
   ImageList orderedImages = sourceImages;
 
   FrameCollection frames;
@@ -28,6 +165,8 @@ int main(int argc, const char *argv[]) {
   int lineWidth = 1;
   int templateOffsetX = 0;
   int templateOffsetY = 0;
+  char path[1024] = "M50,150L150,50L250,150Z";
+  bool vector = false;
 
   float offsetScaleStep = MATCH_OFFSET_SCALE_STEP;
   int offsetXStep = MATCH_OFFSET_X_STEP;
@@ -48,6 +187,41 @@ int main(int argc, const char *argv[]) {
   std::cout << "Loaded " << sourceImages.count() << " images from store in "
             << readElapsed.count() << "s\n";
 
+  if (!batchPath.empty()) {
+    runBatch(sourceImages, batchPath, batchName, matchOptions);
+    return 0;
+  }
+
+  // Pick up images added by `process_images` in watch mode. The reload
+  // itself happens on the main thread between frames. If the directories
+  // can't be watched, matching carries on without
+  std::atomic_bool stopWatching(false);
+  std::atomic_bool storeChanged(false);
+  std::unique_ptr<DirectoryWatcher> watcher;
+  try {
+    watcher.reset(new DirectoryWatcher(sourceImages.mountPaths()));
+  } catch (const std::exception &error) {
+    std::cerr << "Not watching for new images: " << error.what() << '\n';
+  }
+
+  std::thread storeWatchThread;
+  if (watcher) {
+    storeWatchThread = std::thread([&]() {
+      try {
+        while (!stopWatching) {
+          for (const std::string &path : watcher->waitForChanges(0)) {
+            if (std::filesystem::path(path).filename() == ".store") {
+              storeChanged = true;
+            }
+          }
+        }
+      } catch (const std::exception &error) {
+        std::cerr << "Stopped watching for new images: " << error.what()
+                  << '\n';
+      }
+    });
+  }
+
   initWindow(OUTPUT_WIDTH, OUTPUT_HEIGHT, "Match debugger");
   GLuint image_tex;
 
@@ -58,18 +232,29 @@ int main(int argc, const char *argv[]) {
   int runs;
   std::chrono::duration<float> matchElapsed;
   std::chrono::duration<float> previewElapsed;
+  size_t matchAllocations = 0;
 
   auto generatePreviewTexture = [&]() {
-    cv::Mat canvas = cv::Mat::zeros(CANVAS_HEIGHT, CANVAS_WIDTH, CV_8UC3);
-
-    cv::Point center(CANVAS_WIDTH / 2 + templateOffsetX,
-                     CANVAS_HEIGHT / 2 + templateOffsetY);
-    if (shape == TemplateShape_Rect) {
-      cv::Point diff(width / 2, height / 2);
-      cv::rectangle(canvas, center - diff, center + diff, cv::Scalar(0, 0, 255),
-                    lineWidth);
-    } else if (shape == TemplateShape_Circle) {
-      cv::circle(canvas, center, width / 2, cv::Scalar(0, 0, 255), lineWidth);
+    TemplateSpec spec;
+    spec.shape = shape;
+    spec.width = width;
+    spec.height = height;
+    spec.lineWidth = lineWidth;
+    spec.offsetX = templateOffsetX;
+    spec.offsetY = templateOffsetY;
+    spec.path = path;
+    cv::Mat canvas;
+    std::shared_ptr<VectorTemplate> shapes;
+    try {
+      canvas = drawTemplate(spec);
+      if (vector && canMatchOutline(matchOptions)) {
+        shapes = std::make_shared<VectorTemplate>(vectorTemplateFor(spec));
+      }
+    } catch (const std::runtime_error &error) {
+      // Half typed paths are expected
+      std::cerr << error.what() << '\n';
+      spec.shape = TemplateShape_Rect;
+      canvas = drawTemplate(spec);
     }
 
     cv::Mat greyCanvas;
@@ -89,13 +274,19 @@ int main(int argc, const char *argv[]) {
     } else {
       auto matchStart = std::chrono::high_resolution_clock::now();
 
+      size_t allocationsBefore = EdgedImage::matchAllocationCount();
+
       sourceImages.provideMatchContext(templateOffsetX, templateOffsetY);
+      sourceImages.provideMatchOptions(matchOptions);
+      sourceImages.provideVectorTemplate(shapes);
       runs = sourceImages.matchTo(greyCanvas, &bestMatch, &bestMatchImage,
                                   offsetScaleStep, offsetXStep, offsetYStep,
                                   minOffsetScale, maxOffset, whiteBias);
 
       auto matchFinish = std::chrono::high_resolution_clock::now();
       matchElapsed = matchFinish - matchStart;
+      matchAllocations =
+          EdgedImage::matchAllocationCount() - allocationsBefore;
 
       orderedImages.sortBy("match-percentage");
 
@@ -108,7 +299,10 @@ int main(int argc, const char *argv[]) {
 
     auto previewStart = std::chrono::high_resolution_clock::now();
 
-    cv::Mat originalImage = bestMatchImage->getOriginal();
+    cv::Mat originalImage = PreviewPack::loadPreview(bestMatchImage->path);
+    if (originalImage.empty()) {
+      originalImage = bestMatchImage->getOriginal();
+    }
 
     if (originalImage.empty()) {
       throw std::runtime_error("Couldn't read source image");
@@ -134,17 +328,25 @@ int main(int argc, const char *argv[]) {
       sourcePlusEdges = originalImage;
     }
 
-    float realScale = (float)bestMatchImage->width / STORED_EDGES_WIDTH;
+    // The preview might be smaller than the original
+    float realScale = (float)originalImage.cols / STORED_EDGES_WIDTH;
+
+    cv::Size canvasSize = orientedSize(cv::Size(CANVAS_WIDTH, CANVAS_HEIGHT),
+                                       bestMatch.orientation);
+    cv::Size boundsSize = rotatedSize(canvasSize, bestMatch.angle);
 
     cv::Rect roi;
     roi.x = round(bestMatch.originX * realScale);
     roi.y = round(bestMatch.originY * realScale);
-    roi.width = round(CANVAS_WIDTH * realScale * bestMatch.scale);
-    roi.height = round(CANVAS_HEIGHT * realScale * bestMatch.scale);
+    roi.width = round(boundsSize.width * realScale * bestMatch.scale);
+    roi.height = round(boundsSize.height * realScale * bestMatch.scale);
 
     cv::Mat scaledImage;
     try {
-      cv::Mat cropped = sourcePlusEdges(roi);
+      cv::Mat cropped;
+      unorientImage(
+          unrotateCrop(sourcePlusEdges(roi), bestMatch.angle, canvasSize),
+          cropped, bestMatch.orientation);
       cv::resize(cropped, scaledImage, cv::Size(OUTPUT_WIDTH, OUTPUT_HEIGHT));
     } catch (cv::Exception) {
       // This sucks but is better than crashing the programme
@@ -177,12 +379,31 @@ int main(int argc, const char *argv[]) {
   openWindow([&](GLFWwindow *window, ImGuiIO &io) {
     bool changed = false;
 
+    if (storeChanged.exchange(false)) {
+      int added = sourceImages.refresh();
+      if (added) {
+        std::cout << "Loaded " << added << " new images from store\n";
+        orderedImages = sourceImages;
+        changed = true;
+      }
+    }
+
     ImGui::SetNextWindowFocus();
     ImGui::Begin("Controls");
 
     changed |= ImGui::RadioButton("Rectangle", &shape, TemplateShape_Rect);
     ImGui::SameLine();
     changed |= ImGui::RadioButton("Circle", &shape, TemplateShape_Circle);
+    ImGui::SameLine();
+    changed |= ImGui::RadioButton("Path", &shape, TemplateShape_Path);
+    if (shape == TemplateShape_Path) {
+      changed |= ImGui::InputText("SVG path", path, sizeof(path));
+    }
+    changed |= ImGui::Checkbox("Match outline?", &vector);
+    if (vector && !canMatchOutline(matchOptions)) {
+      ImGui::SameLine();
+      ImGui::Text("(upright only, matching pixels)");
+    }
     changed |= ImGui::SliderInt("Width", &width, 0, CANVAS_WIDTH + 50);
     ImGui::SameLine();
     if (ImGui::SmallButton("-##lesswidth")) {
@@ -230,6 +451,31 @@ int main(int argc, const char *argv[]) {
     changed |= ImGui::SliderFloat("Min offset scale", &minOffsetScale, 0, 0.9);
     changed |= ImGui::SliderInt("Max offset", &maxOffset, 1, 50);
     changed |= ImGui::SliderFloat("White bias", &whiteBias, 0, 1);
+    changed |= ImGui::Checkbox("Warm start?", &matchOptions.warmStart);
+    ImGui::SameLine();
+    changed |= ImGui::Checkbox("Refine?", &matchOptions.refine);
+    changed |= ImGui::RadioButton("Upright", &matchOptions.orientations,
+                                  MatchOrientationSet_Upright);
+    ImGui::SameLine();
+    changed |= ImGui::RadioButton("Rotated", &matchOptions.orientations,
+                                  MatchOrientationSet_Rotations);
+    ImGui::SameLine();
+    changed |= ImGui::RadioButton("Rotated or mirrored",
+                                  &matchOptions.orientations,
+                                  MatchOrientationSet_All);
+    changed |= ImGui::SliderFloat("Angles either side",
+                                  &matchOptions.angleRange, 0, 45, "%.1f");
+    if (matchOptions.angleRange > 0) {
+      changed |= ImGui::SliderFloat("Angle step", &matchOptions.angleStep, 0.5,
+                                    15, "%.1f");
+    }
+    changed |= ImGui::Checkbox("Sequential?", &matchOptions.sequential);
+    if (matchOptions.sequential) {
+      ImGui::SameLine();
+      changed |= ImGui::Checkbox("Audit?", &matchOptions.auditSequential);
+      changed |= ImGui::SliderFloat("Error rate", &matchOptions.errorRate,
+                                    0.001, 0.2, "%.3f");
+    }
 
     ImGui::NewLine();
 
@@ -261,10 +507,49 @@ int main(int argc, const char *argv[]) {
       ImGui::Text("%% match: %.1f%%", bestMatch.percentage * 100);
       ImGui::Text("Scale: %.2f", bestMatch.scale);
       ImGui::Text("Offset: (%i,%i)", bestMatch.originX, bestMatch.originY);
+      ImGui::Text("Orientation: %i, %.1f degrees", bestMatch.orientation,
+                  bestMatch.angle);
       ImGui::Text("Runs: %i", runs);
       ImGui::Text("Match timer: %.2fs (%.2fs avg)", matchElapsed.count(),
                   matchElapsed.count() / orderedImages.count());
       ImGui::Text("Preview timer: %.2fs", previewElapsed.count());
+      ImGui::Text("Match allocations: %zu", matchAllocations);
+
+      if (matchOptions.warmStart) {
+        auto [kept, missed] = EdgedImage::warmStartCounts();
+        ImGui::Text("Warm starts: %zu kept, %zu searched in full", kept,
+                    missed);
+      }
+      if (matchOptions.refine) {
+        auto [evaluations, improved] = EdgedImage::refineCounts();
+        ImGui::Text("Refining: %zu evaluations, improved %zu matches",
+                    evaluations, improved);
+      }
+      if (matchOptions.angleRange > 0) {
+        auto [searched, views] = EdgedImage::angleCounts();
+        ImGui::Text("Angles: searched %zu of %zu", searched, views);
+      }
+      if (matchOptions.sequential) {
+        SequentialStats stats = EdgedImage::sequentialStats();
+        ImGui::Text("Sequential: rejected %zu of %zu placements, %.0f "
+                    "samples avg",
+                    stats.rejections, stats.placements,
+                    (float)stats.samples /
+                        std::max(stats.placements, (size_t)1));
+        if (matchOptions.auditSequential) {
+          ImGui::Text("Wrongly rejected: %zu", stats.misses);
+        }
+      }
+
+      LruCacheStats planeStats = EdgedImage::planeCacheStats();
+      ImGui::Text("Plane cache: %zu hits, %zu misses, %zuMB",
+                  planeStats.hits, planeStats.misses,
+                  planeStats.bytes / 1048576);
+
+      ImageCacheStats imageStats = ImageCache::shared().stats();
+      ImGui::Text("Image cache: %zu hits, %zu misses, %zu evictions, %zuMB",
+                  imageStats.hits, imageStats.misses, imageStats.evictions,
+                  imageStats.bytes / 1048576);
 
       ImGui::TreePop();
     }
@@ -354,4 +639,9 @@ int main(int argc, const char *argv[]) {
   });
 
   glDeleteTextures(1, &image_tex);
+
+  stopWatching = true;
+  if (storeWatchThread.joinable()) {
+    storeWatchThread.join();
+  }
 }
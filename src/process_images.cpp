@@ -7,56 +7,62 @@
 #include "lib/detect-edge.hpp"
 #include "lib/edit-image-edges.hpp"
 #include "lib/image-list.hpp"
+#include "lib/template-spec.hpp"
 
+// Takes an image ID or path, and gives the image's current position in the
+// store
 std::optional<int> imageFromArg(ImageList &imageList, const std::string &arg) {
   if (arg.empty()) {
     std::cerr << "Argument required\n";
     return {};
   }
 
-  int id = -1;
+  auto image = imageList.end();
   try {
-    id = stoi(arg);
+    image = imageList.find(stoi(arg));
   } catch (std::invalid_argument) {
-    for (size_t i = 0; i < imageList.count(); ++i) {
-      if (imageList.at(i)->path == arg) {
-        id = i;
-        break;
-      }
-    }
+    image = std::find_if(imageList.begin(), imageList.end(),
+                         [&](const std::shared_ptr<EdgedImage> &image) {
+                           return image->path == arg;
+                         });
   }
 
-  if (id == -1) {
+  if (image == imageList.end()) {
     std::cerr << "Image not found\n";
     return {};
   }
 
-  if (id > imageList.count() - 1) {
-    std::cerr << "That image doesn't exist: highest ID is "
-      << (imageList.count() - 1) << '\n';
-    return {};
-  }
-
-  return id;
+  return image - imageList.begin();
 }
 
 int main(int argc, const char *argv[]) {
   auto readStart = std::chrono::high_resolution_clock::now();
 
-  if (!argv[1]) {
+  std::vector<std::string> dirPaths;
+  bool recursive = false;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--recursive") == 0 || strcmp(argv[i], "-r") == 0) {
+      recursive = true;
+    } else {
+      dirPaths.push_back(argv[i]);
+    }
+  }
+
+  if (dirPaths.empty()) {
     std::cerr << "No directory specified, exiting\n";
     exit(1);
   }
 
   std::cout << std::fixed << std::setprecision(2);
 
-  ImageList imageList(argv[1]);
+  ImageList imageList(dirPaths, recursive);
 
   if (imageList.count()) {
     auto readFinish = std::chrono::high_resolution_clock::now();
     std::chrono::duration<float> readElapsed = readFinish - readStart;
 
-    std::cout << "Loaded " << imageList.count() << " images from store in "
+    std::cout << "Loaded " << imageList.count() << " images from "
+              << imageList.mountPaths().size() << " stores in "
               << readElapsed.count() << "s\n";
   } else {
     std::cout << "No store found for this directory, type \"generate\" to "
@@ -117,6 +123,7 @@ int main(int argc, const char *argv[]) {
       auto finish = std::chrono::high_resolution_clock::now();
       std::chrono::duration<float> elapsed = finish - start;
       std::cout << "Generated in " << elapsed.count() << "s\n";
+      std::cout << imageList.decodeStats << '\n';
     } else if (command == "sync") {
       auto imageListBackup = imageList;
 
@@ -127,6 +134,8 @@ int main(int argc, const char *argv[]) {
         continue;
       }
 
+      std::cout << imageList.decodeStats << '\n';
+
       char prompt[35];
       sprintf(prompt, "%i new images found, save? (Y/n) ", newImages);
 
@@ -143,14 +152,36 @@ int main(int argc, const char *argv[]) {
       } else {
         imageList = imageListBackup;
       }
+    } else if (command == "watch") {
+      std::cout << "Watching for new images, press enter to stop\n";
+
+      // Anything going wrong while watching stops it, rather than the
+      // whole programme
+      std::atomic_bool stop(false);
+      std::thread watchThread([&]() {
+        try {
+          imageList.watch(stop);
+        } catch (const std::exception &error) {
+          std::cerr << "Stopped watching: " << error.what()
+                    << "\nPress enter to continue\n";
+        }
+      });
+
+      std::string line;
+      std::getline(std::cin, line);
+
+      std::cout << "Stopping…\n";
+      stop = true;
+      watchThread.join();
+    } else if (command == "previews") {
+      int added = imageList.generatePreviews();
+      std::cout << "Made previews for " << added << " images\n";
     } else if (command == "ls") {
       std::cout << imageList.count() << " images in store:\n\n";
 
-      int i = 0;
       for (const std::shared_ptr<EdgedImage> &image : imageList) {
-        std::cout << i << ": " << image->path << " (" << image->width << "x"
-                  << image->height << ")\n";
-        i++;
+        std::cout << imageList.idOf(*image) << ": " << image->path << " ("
+                  << image->width << "x" << image->height << ")\n";
       }
 
       std::cout << '\n';
@@ -181,12 +212,12 @@ int main(int argc, const char *argv[]) {
         continue;
       }
 
-      int id = maybeImage.value();
-      std::string path = imageList.at(id)->path;
+      int pos = maybeImage.value();
+      std::string path = imageList.at(pos)->path;
 
       std::cout << "Removing: " << path << "\n";
 
-      imageList.erase(id);
+      imageList.erase(pos);
       imageList.save();
 
       char prompt[60];
@@ -206,6 +237,123 @@ int main(int argc, const char *argv[]) {
     } else if (command == "sort") {
       imageList.sortBy("path");
       std::cout << "Sorted by file path - this will not be saved to store\n";
+    } else if (command == "bench") {
+      // Matches a plain rectangle against the whole store. The images are
+      // copied first, so that changing how their edges are held doesn't
+      // change it for the store
+      ImageList benchList = imageList;
+      for (std::shared_ptr<EdgedImage> &image : benchList) {
+        image = std::make_shared<EdgedImage>(*image);
+      }
+
+      TemplateSpec benchSpec;
+      benchSpec.height = CANVAS_HEIGHT;
+      cv::Mat benchTemplate = drawTemplateGrey(benchSpec);
+
+      auto benchMatch = [&]() {
+        ImageMatch match;
+        EdgedImage *matchImage = nullptr;
+        benchList.resetMatchContext();
+
+        auto start = std::chrono::high_resolution_clock::now();
+        benchList.matchTo(benchTemplate, &match, &matchImage);
+        auto finish = std::chrono::high_resolution_clock::now();
+
+        std::chrono::duration<float> elapsed = finish - start;
+        return elapsed.count() * 1000;
+      };
+
+      std::cout << "Separate edges: " << benchList.scanEdges() << '\n'
+                << "  matched in " << benchMatch() << "ms\n";
+      benchList.useArena();
+      std::cout << "Edge arena: " << benchList.scanEdges() << '\n'
+                << "  matched in " << benchMatch() << "ms\n";
+      benchList.useRuns();
+      std::cout << "Edge runs: " << benchList.scanEdges() << '\n'
+                << "  matched in " << benchMatch() << "ms\n";
+
+      // Quality against cost of the grid, refining it, and a grid four times
+      // as fine
+      auto benchSearch = [&](const char *name, const MatchOptions &options,
+                             float scaleStep, int xStep, int yStep) {
+        ImageMatch match;
+        EdgedImage *matchImage = nullptr;
+        benchList.resetMatchContext();
+        benchList.provideMatchOptions(options);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        int runs = benchList.matchTo(benchTemplate, &match, &matchImage,
+                                     scaleStep, xStep, yStep);
+        auto finish = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<float> elapsed = finish - start;
+
+        float total = 0;
+        for (const std::shared_ptr<EdgedImage> &image : benchList) {
+          total += image->lastMatch.percentage;
+        }
+
+        std::cout << name << ": best " << match.percentage * 100 << "%, mean "
+                  << total / std::max(benchList.count(), 1) * 100 << "%, "
+                  << runs << " evaluations in " << elapsed.count() * 1000
+                  << "ms\n";
+      };
+
+      MatchOptions refineOptions;
+      refineOptions.refine = true;
+      benchSearch("Grid", MatchOptions(), MATCH_OFFSET_SCALE_STEP,
+                  MATCH_OFFSET_X_STEP, MATCH_OFFSET_Y_STEP);
+      benchSearch("Grid then refined", refineOptions, MATCH_OFFSET_SCALE_STEP,
+                  MATCH_OFFSET_X_STEP, MATCH_OFFSET_Y_STEP);
+      benchSearch("Fine grid", MatchOptions(), MATCH_OFFSET_SCALE_STEP / 4,
+                  std::max(MATCH_OFFSET_X_STEP / 4, 1),
+                  std::max(MATCH_OFFSET_Y_STEP / 4, 1));
+
+      // Sequential screening in place of the every tenth row and column
+      // screen, then again matching everything it rejects to count mistakes
+      MatchOptions sequentialOptions;
+      sequentialOptions.sequential = true;
+      SequentialStats before = EdgedImage::sequentialStats();
+      benchSearch("Sequential", sequentialOptions, MATCH_OFFSET_SCALE_STEP,
+                  MATCH_OFFSET_X_STEP, MATCH_OFFSET_Y_STEP);
+      SequentialStats after = EdgedImage::sequentialStats();
+      size_t placements = std::max(after.placements - before.placements,
+                                   (size_t)1);
+      std::cout << "  rejected "
+                << (float)(after.rejections - before.rejections) / placements *
+                       100
+                << "% of placements, "
+                << (float)(after.samples - before.samples) / placements
+                << " samples avg\n";
+
+      sequentialOptions.auditSequential = true;
+      before = EdgedImage::sequentialStats();
+      benchSearch("Sequential audited", sequentialOptions,
+                  MATCH_OFFSET_SCALE_STEP, MATCH_OFFSET_X_STEP,
+                  MATCH_OFFSET_Y_STEP);
+      after = EdgedImage::sequentialStats();
+      size_t rejections = after.rejections - before.rejections;
+      std::cout << "  " << after.misses - before.misses << " of " << rejections
+                << " rejections wrong, "
+                << (float)(after.misses - before.misses) /
+                       std::max(rejections, (size_t)1) * 100
+                << "% against " << sequentialOptions.errorRate * 100
+                << "% allowed\n";
+
+      // Rotations either side, coarse to fine, against every angle there was
+      MatchOptions angleOptions;
+      angleOptions.angleRange = 15;
+      auto [searchedBefore, viewsBefore] = EdgedImage::angleCounts();
+      benchSearch("Grid with angles", angleOptions, MATCH_OFFSET_SCALE_STEP,
+                  MATCH_OFFSET_X_STEP, MATCH_OFFSET_Y_STEP);
+      auto [searchedAfter, viewsAfter] = EdgedImage::angleCounts();
+      std::cout << "  searched " << searchedAfter - searchedBefore << " of "
+                << viewsAfter - viewsBefore << " angles\n";
+
+      // The same shape matched along its outline instead
+      benchList.provideVectorTemplate(
+          std::make_shared<VectorTemplate>(vectorTemplateFor(benchSpec)));
+      benchSearch("Outline", MatchOptions(), MATCH_OFFSET_SCALE_STEP,
+                  MATCH_OFFSET_X_STEP, MATCH_OFFSET_Y_STEP);
     } else if (command == "save") {
       imageList.save(false);
       std::cout << "Store saved\n";